@@ -77,6 +77,8 @@ bool StartAlignment();
 bool StartMovement();
 bool ProcessOrientCommand();
 bool ProcessMovementCommand();
+void StopMotors();
+void PilotNotifications(int priorPilotState);
 
 enum {
 	PILOT_STATE_IDLE,		//ready for a command
@@ -102,6 +104,15 @@ enum {
 pthread_t AutopilotInit() {
 	pilotDebugFile = fopen("/root/logfiles/pilot.log", "w");
 
+	psRegisterQueueStats(&autopilotQueue, "autopilot");
+
+	psSubscribe(MOVEMENT, AutopilotProcessMessage);
+	psSubscribe(ORIENT, AutopilotProcessMessage);
+	psSubscribe(TICK_1S, AutopilotProcessMessage);
+	psSubscribe(POSE, AutopilotProcessMessage);
+	psSubscribe(ODOMETRY, AutopilotProcessMessage);
+	psSubscribe(NOTIFICATION, AutopilotProcessMessage);
+
 	//create autopilot thread
 	pthread_t thread;
 	int s = pthread_create(&thread, NULL, AutopilotThread, NULL);
@@ -153,6 +164,9 @@ void AutopilotProcessMessage(psMessage_t *msg) {
 void *AutopilotThread(void *arg) {
 
 	int priorPilotState;	//used to cancel notifications
+	psMessage_t *rxMessage;
+	int timer;
+	bool motorProgress;		//odometry shows the wheels turning
 
 	PowerState_enum powerState = POWER_STATE_UNKNOWN;
 
@@ -162,7 +176,29 @@ void *AutopilotThread(void *arg) {
 
 	//loop
 	while (1) {
-		psMessage_t *rxMessage = GetNextMessage(&autopilotQueue);
+		if (GetQueueEvents(&autopilotQueue, &rxMessage, 1, &timer) == 0)
+		{
+			//PILOT_MOTOR_TIMER - no progress from the motors
+			priorPilotState = pilotState;
+
+			switch (pilotState)
+			{
+			case PILOT_STATE_ORIENTING:
+			case PILOT_STATE_ALIGNING:
+			case PILOT_STATE_MOVING:
+			case PILOT_STATE_FORWARD:
+			case PILOT_STATE_BACKWARD:
+				ERRORPRINT("Pilot: motors timeout\n");
+				StopMotors();		//the last command would otherwise stay in force
+				pilotState = PILOT_STATE_FAILED;
+				break;
+			default:
+				break;
+			}
+			PilotNotifications(priorPilotState);
+			continue;
+		}
+		motorProgress = false;
 
 		//general processing
 		switch (rxMessage->header.messageType) {
@@ -189,6 +225,7 @@ void *AutopilotThread(void *arg) {
 		{
 			odometryPayload = rxMessage->odometryPayload;
 			gettimeofday(&latestOdoTime, NULL);
+			motorProgress = (odometryPayload.portMovement != 0 || odometryPayload.starboardMovement != 0);
 			struct timeval result;
 			if ((timeval_subtract (&result, &latestOdoTime, &latestMotorTime) == 0) && (result.tv_sec > 1))
 			{
@@ -259,7 +296,7 @@ void *AutopilotThread(void *arg) {
 				ProcessOrientCommand();
 				break;
 			case TICK_1S:
-				//TODO: timeout?
+				//timeout by PILOT_MOTOR_TIMER
 				break;
 			case POSE:
 			case ODOMETRY:
@@ -305,7 +342,7 @@ void *AutopilotThread(void *arg) {
 				ProcessOrientCommand();
 				break;
 			case TICK_1S:
-				//TODO: timeout?
+				//timeout by PILOT_MOTOR_TIMER
 				break;
 			case POSE:
 			case ODOMETRY:
@@ -357,7 +394,7 @@ void *AutopilotThread(void *arg) {
 				ProcessOrientCommand();
 				break;
 			case TICK_1S:
-				//TODO: timeout?
+				//timeout by PILOT_MOTOR_TIMER
 				break;
 			case POSE:
 			case ODOMETRY:
@@ -404,7 +441,7 @@ void *AutopilotThread(void *arg) {
 				ProcessOrientCommand();
 				break;
 			case TICK_1S:
-				//TODO: timeout?
+				//timeout by PILOT_MOTOR_TIMER
 				break;
 			case POSE:
 			case ODOMETRY:
@@ -449,43 +486,81 @@ void *AutopilotThread(void *arg) {
 			DEBUGPRINT("Motors P: %i, S: %i\n", pilotMotorMessage.motorPayload.portMotors, pilotMotorMessage.motorPayload.starboardMotors)
 		}
 
-		if (priorPilotState != pilotState) {
-			switch (priorPilotState) {
-			case PILOT_STATE_IDLE:
-			case PILOT_STATE_INACTIVE:
-				break;
-			case PILOT_STATE_ORIENTING:
-			case PILOT_STATE_ALIGNING:
-			case PILOT_STATE_MOVING:
-				CancelNotification(PILOT_ENGAGED);
-				break;
-			case PILOT_STATE_DONE:
-				CancelNotification(PILOT_DONE);
-				break;
-			case PILOT_STATE_FAILED:
-				CancelNotification(PILOT_FAILED);
-				break;
-			}
-			switch (pilotState) {
-			case PILOT_STATE_IDLE:
-			case PILOT_STATE_INACTIVE:
-				break;
-			case PILOT_STATE_ORIENTING:
-			case PILOT_STATE_ALIGNING:
-			case PILOT_STATE_MOVING:
-				Notify(PILOT_ENGAGED);
-				break;
-			case PILOT_STATE_DONE:
-				Notify(PILOT_DONE);
-				break;
-			case PILOT_STATE_FAILED:
-				Notify(PILOT_FAILED);
-				break;
+		//motor progress watchdog - re-armed by a new motor command or odometry showing movement
+		switch (pilotState)
+		{
+		case PILOT_STATE_ORIENTING:
+		case PILOT_STATE_ALIGNING:
+		case PILOT_STATE_MOVING:
+		case PILOT_STATE_FORWARD:
+		case PILOT_STATE_BACKWARD:
+			if (sendMovementMessage || motorProgress)
+			{
+				SetQueueTimer(&autopilotQueue, PILOT_MOTOR_TIMER, MOTOR_PROGRESS_TIMEOUT);
 			}
+			break;
+		default:
+			CancelQueueTimer(&autopilotQueue, PILOT_MOTOR_TIMER);
+			break;
+		}
+
+		PilotNotifications(priorPilotState);
+	}
+}
+
+//notify changes of pilot state
+void PilotNotifications(int priorPilotState)
+{
+	if (priorPilotState != pilotState) {
+		switch (priorPilotState) {
+		case PILOT_STATE_IDLE:
+		case PILOT_STATE_INACTIVE:
+			break;
+		case PILOT_STATE_ORIENTING:
+		case PILOT_STATE_ALIGNING:
+		case PILOT_STATE_MOVING:
+			CancelNotification(PILOT_ENGAGED);
+			break;
+		case PILOT_STATE_DONE:
+			CancelNotification(PILOT_DONE);
+			break;
+		case PILOT_STATE_FAILED:
+			CancelNotification(PILOT_FAILED);
+			break;
+		}
+		switch (pilotState) {
+		case PILOT_STATE_IDLE:
+		case PILOT_STATE_INACTIVE:
+			break;
+		case PILOT_STATE_ORIENTING:
+		case PILOT_STATE_ALIGNING:
+		case PILOT_STATE_MOVING:
+			Notify(PILOT_ENGAGED);
+			break;
+		case PILOT_STATE_DONE:
+			Notify(PILOT_DONE);
+			break;
+		case PILOT_STATE_FAILED:
+			Notify(PILOT_FAILED);
+			break;
 		}
 	}
 }
 
+//zero range move - the motors stop where they are
+void StopMotors()
+{
+	pilotMotorMessage.motorPayload.portMotors = pilotMotorMessage.motorPayload.starboardMotors = 0;
+	pilotMotorMessage.motorPayload.speed = 0;
+	pilotMotorMessage.motorPayload.flags = 0;
+
+	RouteMessage(&pilotMotorMessage);
+	gettimeofday(&latestMotorTime, NULL);
+	motorsState = MOTORS_STATE_IDLE;
+
+	DEBUGPRINT("Motors stopped\n");
+}
+
 bool StartOrient()
 {
 	//initiate turn to 'desiredCompassHeading'
@@ -13,5 +13,10 @@ pthread_t AutopilotInit();
 
 void AutopilotProcessMessage(psMessage_t *msg);
 
+//autopilot queue timers
+#define PILOT_MOTOR_TIMER		0	//no progress from the motors
+
+#define MOTOR_PROGRESS_TIMEOUT	10000	//mS
+
 
 #endif
@@ -51,6 +51,22 @@ pthread_t BehaviorInit()
 		return -1;
 	}
 
+	//periodic state keeps only its latest, so a stalled script never backs up on it
+	SetQueueCoalesce(&behaviorQueue, TICK_1S);
+	SetQueueCoalesce(&behaviorQueue, BATTERY);
+	//a dispatcher never waits on lua - past the limit commands are refused, counted and logged
+	SetQueuePolicy(&behaviorQueue, BEHAVIOR_Q_DEPTH, BROKER_Q_DROP_NEWEST);
+	psRegisterQueueStats(&behaviorQueue, "behavior");
+
+	//messages that update lua globals or trigger hooks
+	psSubscribeQueue(RELOAD, &behaviorQueue);
+	psSubscribeQueue(ACTIVATE, &behaviorQueue);
+	psSubscribeQueue(TICK_1S, &behaviorQueue);
+	psSubscribeQueue(BATTERY, &behaviorQueue);
+	psSubscribeQueue(NEW_SETTING, &behaviorQueue);
+	psSubscribeQueue(SET_OPTION, &behaviorQueue);
+	psSubscribeQueue(NOTIFICATION, &behaviorQueue);
+
 	int s = pthread_create(&thread, NULL, ScriptThread, NULL);
 	if (s != 0)
 	{
@@ -75,22 +91,28 @@ void BehaviorProcessMessage(psMessage_t *msg)
 //thread to receive messages and update lua globals
 void *BehaviorMessageThread(void *arg)
 {
+	psMessage_t *batch[BROKER_Q_BATCH];
+	int batchCount, i;
+
 	DEBUGPRINT("Behavior message thread started\n");
 
 	while (1)
 	{
-		psMessage_t *msg = GetNextMessage(&behaviorQueue);
+		batchCount = GetNextMessages(&behaviorQueue, batch, BROKER_Q_BATCH, -1);
 
-		//	DEBUGPRINT("BT msg: %s\n", psLongMsgNames[msg->header.messageType]);
+		//	DEBUGPRINT("BT batch: %i\n", batchCount);
 
-		//critical section
+		//critical section - one lua lock per batch
 		int s = pthread_mutex_lock(&luaMtx);
 		if (s != 0)
 		{
 			ERRORPRINT("BT: lua mutex lock %i\n", s);
 		}
 
-		ScriptProcessMessage(msg);	//update lua globals as necessary
+		for (i=0; i<batchCount; i++)
+		{
+			ScriptProcessMessage(batch[i]);	//update lua globals as necessary
+		}
 
 		s = pthread_mutex_unlock(&luaMtx);
 		if (s != 0)
@@ -99,7 +121,7 @@ void *BehaviorMessageThread(void *arg)
 		}
 		//end critical section
 
-		DoneWithMessage(msg);
+		DoneWithMessages(batch, batchCount);
 	}
 	return 0;
 }
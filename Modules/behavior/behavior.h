@@ -18,6 +18,8 @@ pthread_t BehaviorInit();
 //update globals and hooks
 void BehaviorProcessMessage(psMessage_t *msg);
 
+#define BEHAVIOR_Q_DEPTH	64		//pending commands per lane - newest refused if lua stalls
+
 int ReportAvailableScripts();
 
 //scripting system
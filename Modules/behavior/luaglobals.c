@@ -24,6 +24,9 @@
 #include "behavior/behaviorDebug.h"
 #include "syslog/syslog.h"
 
+//blackboard history queries
+static int Aggregate(lua_State *L);			//count, min, max, mean, last = Aggregate("battery.volts", -3600, 0)
+static int History(lua_State *L);			//times, values = History("battery.volts", -600, 0)
 
 //load all (constant) lua globals with default values
 int InitLuaGlobals(lua_State *L)
@@ -127,6 +130,12 @@ int InitLuaGlobals(lua_State *L)
 	}
 	lua_setglobal(L, "orient");
 
+	//history queries
+	lua_pushcfunction(L, Aggregate);
+	lua_setglobal(L, "Aggregate");
+	lua_pushcfunction(L, History);
+	lua_setglobal(L, "History");
+
 	return LoadAllScripts(L);
 }
 
@@ -183,6 +192,59 @@ void SetGlobal(lua_State *L, const char *name, float value)
 	lua_setglobal(L, name);
 }
 
+//----------------------------------------BLACKBOARD QUERIES
+//times as bbGetMessage - absolute, or seconds before now if zero or negative
+static int Aggregate(lua_State *L)			//Aggregate("field", from, to)
+{
+	const char *field = lua_tostring(L, 1);
+	time_t from = lua_tointeger(L, 2);
+	time_t to = lua_tointeger(L, 3);
+	bbAggregate_t aggregate;
+
+	if (field == NULL || !bbGetAggregate(field, from, to, &aggregate))
+	{
+		lua_pushnil(L);
+		return 1;
+	}
+	lua_pushinteger(L, aggregate.count);
+	lua_pushnumber(L, aggregate.min);
+	lua_pushnumber(L, aggregate.max);
+	lua_pushnumber(L, aggregate.mean);
+	lua_pushnumber(L, aggregate.last);
+	return 5;
+}
+
+static int History(lua_State *L)			//History("field", from, to)
+{
+	const char *field = lua_tostring(L, 1);
+	time_t from = lua_tointeger(L, 2);
+	time_t to = lua_tointeger(L, 3);
+	double values[BB_SERIES_SLOTS];
+	time_t times[BB_SERIES_SLOTS];
+	int i;
+
+	int count = (field ? bbGetFieldRange(field, from, to, values, times, BB_SERIES_SLOTS) : -1);
+	if (count < 0)
+	{
+		lua_pushnil(L);
+		return 1;
+	}
+
+	lua_createtable(L, count, 0);		//times, oldest first
+	for (i=0; i<count; i++)
+	{
+		lua_pushinteger(L, times[i]);
+		lua_rawseti(L, -2, i + 1);
+	}
+	lua_createtable(L, count, 0);		//values
+	for (i=0; i<count; i++)
+	{
+		lua_pushnumber(L, values[i]);
+		lua_rawseti(L, -2, i + 1);
+	}
+	return 2;
+}
+
 //----------------------------------------LOADING LUA SCRIPTS
 int LoadAllScripts(lua_State *L)
 {
@@ -0,0 +1,646 @@
+/*
+ * bbStore.c
+ *
+ * Blackboard history - per type series of ring buffer tiers (see bbStore.h)
+ *
+ * A sample is saved to the raw tier. As it passes a tier's retention it moves to the next,
+ * where it replaces the newest sample of the same period - so each tier keeps the latest
+ * sample of each second, minute or hour, as the old list garbage collector did. A sample
+ * arriving faster than the raw tier holds pushes its oldest on early rather than losing it.
+ *
+ * Ageing is done by each save, for that type only, under that type's lock - there is no
+ * sweep of the whole store, and a save costs the same however much history is kept.
+ *
+ * Each save also updates the type's latest value slot, a seqlock: the sequence is odd while
+ * the slot is written, and a reader that sees it odd or changed across its copy copies again.
+ * The type's lock keeps a single writer per slot.
+ *
+ * The history file is mapped shared, so what a save writes is in the page cache as soon as it
+ * is written and survives the process being killed. A series interrupted mid save is left
+ * with an odd sequence, and is cleared when the file is reloaded, as is any series that does
+ * not check out. A file from a build with different messages, or of the wrong size, is
+ * started afresh. The file's blocks are reserved when it is mapped, so a full disk fails
+ * at start up, falling back to memory, rather than faulting on a later save.
+ *
+ * The latest value slots are not reloaded - until a type is saved again, its last run's
+ * values are found as history only, never as current.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: martin
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "PubSubData.h"
+#include "bbStore.h"
+#include "blackboardDebug.h"
+
+const bbTierSpec_t bbTiers[BB_TIER_COUNT] = {
+		{"raw",		BB_RAW_SLOTS,		0,													0,		10},
+		{"second",	BB_SECOND_SLOTS,	BB_RAW_SLOTS,										1,		60},
+		{"minute",	BB_MINUTE_SLOTS,	BB_RAW_SLOTS + BB_SECOND_SLOTS,						60,		3600},
+		{"hour",	BB_HOUR_SLOTS,		BB_RAW_SLOTS + BB_SECOND_SLOTS + BB_MINUTE_SLOTS,	3600,	3600 * 24},
+};
+
+bbHistory_t *bbHistory;									//mapped by bbStoreInit
+bbSeries_t *bbSeries[PS_MSG_COUNT];
+pthread_mutex_t	bbSeriesMtx[PS_MSG_COUNT];				//one per type
+bbLatest_t bbLatest[PS_MSG_COUNT];
+
+//queryable fields - the field's type comes from its declaration
+#define BB_FIELD_KIND(m) (__builtin_types_compatible_p(typeof(m), float) || __builtin_types_compatible_p(typeof(m), double) ? BB_FIELD_FLOAT \
+		: ((typeof(m)) -1 < 0) ? BB_FIELD_SIGNED : BB_FIELD_UNSIGNED)
+
+#define fieldmacro(n, t, m) {n, t, offsetof(psMessage_t, m), sizeof(((psMessage_t*)0)->m), BB_FIELD_KIND(((psMessage_t*)0)->m)},
+const bbField_t bbFields[] = {
+#include "BlackboardFields.h"
+};
+#undef fieldmacro
+const int bbFieldCount = sizeof(bbFields) / sizeof(bbField_t);
+
+#define BB_CLOCK_SLACK	10		//seconds the clock may step back before it is reported
+bool bbClockBehind[PS_MSG_COUNT];						//reported once until it catches up
+
+static bool SeriesValid(bbSeries_t *s);
+static void LatestUpdate(bbLatest_t *latest, psMessage_t *msg, int64_t stamp);
+static inline int TierSlot(bbSeries_t *s, int t, uint32_t i);
+
+//FNV-1a over each type's format and length - a file is only reloaded by the same messages
+static uint32_t FormatsHash()
+{
+	uint32_t hash = 2166136261u;
+	int i;
+
+	for (i=0; i<PS_MSG_COUNT; i++)
+	{
+		hash = (hash ^ (uint32_t) psMsgFormats[i]) * 16777619u;
+		hash = (hash ^ (uint32_t) psMessageFormatLengths[psMsgFormats[i]]) * 16777619u;
+	}
+	return hash;
+}
+
+//map the history file, or memory if there is none
+static bbHistory_t *HistoryMap(const char *path)
+{
+	bbHistoryHeader_t header;
+	bbHistory_t *history;
+
+	if (path == NULL)
+	{
+		history = mmap(NULL, sizeof(bbHistory_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		return (history == MAP_FAILED ? NULL : history);
+	}
+
+	int fd = open(path, O_CREAT | O_RDWR, 0644);
+	if (fd < 0)
+	{
+		ERRORPRINT("bbStore: open %s: %s - history kept in memory\n", path, strerror(errno));
+		return HistoryMap(NULL);
+	}
+
+	//a file from another build, or cut short, is emptied - a mapping past its end would fault
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size != (off_t) sizeof(bbHistory_t)
+			|| pread(fd, &header, sizeof(header), 0) != sizeof(header)
+			|| header.magic != BB_HISTORY_MAGIC || header.version != BB_HISTORY_VERSION
+			|| header.types != PS_MSG_COUNT || header.seriesSize != sizeof(bbSeries_t)
+			|| header.formats != FormatsHash())
+	{
+		DEBUGPRINT("bbStore: new history %s\n", path);
+		if (ftruncate(fd, 0) < 0)
+		{
+			ERRORPRINT("bbStore: ftruncate: %s - history kept in memory\n", strerror(errno));
+			close(fd);
+			return HistoryMap(NULL);
+		}
+	}
+
+	//reserve every block now - a store to a hole on a full card would fault, not fail
+	int s = posix_fallocate(fd, 0, sizeof(bbHistory_t));
+	if (s != 0)
+	{
+		ERRORPRINT("bbStore: fallocate: %s - history kept in memory\n", strerror(s));
+		close(fd);
+		return HistoryMap(NULL);
+	}
+
+	history = mmap(NULL, sizeof(bbHistory_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (history == MAP_FAILED)
+	{
+		ERRORPRINT("bbStore: mmap: %s\n", strerror(errno));
+		return NULL;
+	}
+
+	if (history->header.magic != BB_HISTORY_MAGIC)
+	{
+		history->header.version = BB_HISTORY_VERSION;
+		history->header.types = PS_MSG_COUNT;
+		history->header.seriesSize = sizeof(bbSeries_t);
+		history->header.formats = FormatsHash();
+		__atomic_store_n(&history->header.magic, BB_HISTORY_MAGIC, __ATOMIC_RELEASE);
+	}
+	return history;
+}
+
+int bbStoreInit(const char *path)
+{
+	int i;
+
+	if (bbHistory) munmap(bbHistory, sizeof(bbHistory_t));
+
+	bbHistory = HistoryMap(path);
+	if (bbHistory == NULL)
+	{
+		ERRORPRINT("bbStore: no memory for history\n");
+		return -1;
+	}
+
+	memset(bbLatest, 0, sizeof(bbLatest));
+	memset(bbClockBehind, 0, sizeof(bbClockBehind));
+	for (i=0; i<PS_MSG_COUNT; i++)
+	{
+		bbSeries_t *series = &bbHistory->series[i];
+		bbSeries[i] = series;
+
+		int s = pthread_mutex_init(&bbSeriesMtx[i], NULL);
+		if (s != 0)
+		{
+			ERRORPRINT("bbStore: mutex init %i\n", s);
+			return -1;
+		}
+
+		//untouched series read as empty without faulting in a page each
+		if (__atomic_load_n(&series->sequence, __ATOMIC_RELAXED) == 0) continue;
+
+		if (!SeriesValid(series))
+		{
+			ERRORPRINT("bbStore: %s history cleared\n", psLongMsgNames[i]);
+			memset(series, 0, sizeof(bbSeries_t));
+		}
+		//the latest values start empty - the last run's are history, not current
+	}
+	return 0;
+}
+
+//slot of the i'th oldest sample in a tier
+static inline int TierSlot(bbSeries_t *s, int t, uint32_t i)
+{
+	return bbTiers[t].base + (int)((s->head[t] - s->count[t] + i) & (bbTiers[t].slots - 1));
+}
+
+//a series reloaded from the file - whole, and in order within and across tiers
+static bool SeriesValid(bbSeries_t *s)
+{
+	int64_t newer = INT64_MAX;			//oldest stamp of the tier before
+	int t;
+	uint32_t i;
+
+	if (s->sequence & 1) return false;
+
+	for (t=0; t<BB_TIER_COUNT; t++)
+	{
+		if (s->count[t] > (uint32_t) bbTiers[t].slots) return false;
+		for (i=s->count[t]; i>0; i--)
+		{
+			int64_t stamp = s->stamp[TierSlot(s, t, i - 1)];
+			if (stamp > newer) return false;
+			newer = stamp;
+		}
+	}
+	return true;
+}
+
+static void TierPromote(bbSeries_t *s, int t, int64_t stamp, psMessage_t *msg);
+
+//append to a tier - a full ring passes its oldest to the next tier early
+static void TierAppend(bbSeries_t *s, int t, int64_t stamp, psMessage_t *msg)
+{
+	int slot = bbTiers[t].base + (int)(s->head[t] & (bbTiers[t].slots - 1));
+
+	if (s->count[t] == (uint32_t) bbTiers[t].slots && t + 1 < BB_TIER_COUNT)
+	{
+		TierPromote(s, t + 1, s->stamp[slot], &s->message[slot]);
+	}
+
+	s->stamp[slot] = stamp;
+	memcpy(&s->message[slot], msg, sizeof(psMessage_t));
+	s->head[t]++;
+	if (s->count[t] < (uint32_t) bbTiers[t].slots) s->count[t]++;
+}
+
+//a sample aged out of tier t-1 - the newest of its period wins
+static void TierPromote(bbSeries_t *s, int t, int64_t stamp, psMessage_t *msg)
+{
+	int period = bbTiers[t].period;
+
+	if (s->count[t] > 0)
+	{
+		int newest = TierSlot(s, t, s->count[t] - 1);
+		if (s->stamp[newest] / period == stamp / period)
+		{
+			s->stamp[newest] = stamp;
+			memcpy(&s->message[newest], msg, sizeof(psMessage_t));
+			return;
+		}
+	}
+	TierAppend(s, t, stamp, msg);
+}
+
+//move samples past their tier's retention down to the next tier
+//usually one per append, but after a gap in the samples every expired one moves in this call
+static void TierAge(bbSeries_t *series, int64_t now)
+{
+	int t;
+
+	for (t=0; t<BB_TIER_COUNT; t++)
+	{
+		while (series->count[t] > 0)
+		{
+			int oldest = TierSlot(series, t, 0);
+			if (now - series->stamp[oldest] < bbTiers[t].retention) break;
+
+			//over a day old - discarded
+			if (t + 1 < BB_TIER_COUNT)
+			{
+				TierPromote(series, t + 1, series->stamp[oldest], &series->message[oldest]);
+			}
+			series->count[t]--;
+		}
+	}
+}
+
+//newest stamp kept, or far in the past if none
+static int64_t SeriesNewest(bbSeries_t *s)
+{
+	int t;
+
+	for (t=0; t<BB_TIER_COUNT; t++)
+	{
+		if (s->count[t] > 0) return s->stamp[TierSlot(s, t, s->count[t] - 1)];
+	}
+	return INT64_MIN / 2;
+}
+
+//called with the type's lock held - the only writer of the slot
+static void LatestUpdate(bbLatest_t *latest, psMessage_t *msg, int64_t stamp)
+{
+	uint32_t sequence = latest->sequence;
+
+	__atomic_store_n(&latest->sequence, sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	latest->stamp = stamp;
+	memcpy(&latest->message, msg, sizeof(psMessage_t));
+
+	__atomic_store_n(&latest->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+int bbStoreSave(psMessage_t *msg, time_t stamp)
+{
+	int type = msg->header.messageType;
+	int reply = 0;
+
+	if (type < 0 || type >= PS_MSG_COUNT)
+	{
+		ERRORPRINT("bbStore: bad message type: %i\n", type);
+		return -1;
+	}
+
+	//critical section
+	int s = pthread_mutex_lock(&bbSeriesMtx[type]);
+	if (s != 0)
+	{
+		ERRORPRINT("bbStore: mutex lock %i\n", s);
+	}
+
+	bbSeries_t *series = bbSeries[type];
+
+	if (series == NULL)
+	{
+		ERRORPRINT("bbStore: not initialized\n");
+		reply = -1;
+	}
+	else
+	{
+		//stamps must not go backwards - a clock behind the history (not yet set at boot)
+		//saves at the newest stamp kept until it catches up, so the history is kept in order
+		int64_t newest = SeriesNewest(series);
+		if (stamp < newest)
+		{
+			if (stamp < newest - BB_CLOCK_SLACK && !bbClockBehind[type])
+			{
+				ERRORPRINT("bbStore: clock is behind %s history - saving at its newest\n", psLongMsgNames[type]);
+				bbClockBehind[type] = true;
+			}
+			stamp = newest;
+		}
+		else bbClockBehind[type] = false;
+
+		//odd while the series is inconsistent
+		uint32_t sequence = series->sequence | 1;
+		__atomic_store_n(&series->sequence, sequence, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+
+		TierAge(series, stamp);
+		TierAppend(series, BB_TIER_RAW, stamp, msg);
+
+		__atomic_store_n(&series->sequence, sequence + 1, __ATOMIC_RELEASE);
+
+		LatestUpdate(&bbLatest[type], msg, stamp);
+	}
+
+	s = pthread_mutex_unlock(&bbSeriesMtx[type]);
+	if (s != 0)
+	{
+		ERRORPRINT("bbStore: mutex unlock %i\n", s);
+	}
+	//end critical section
+
+	return reply;
+}
+
+//newest sample in tier t at or before 'when', -1 if all are later
+static int TierSearch(bbSeries_t *s, int t, int64_t when)
+{
+	uint32_t low = 0;
+	uint32_t high = s->count[t];
+
+	//first sample later than 'when'
+	while (low < high)
+	{
+		uint32_t mid = low + (high - low) / 2;
+		if (s->stamp[TierSlot(s, t, mid)] <= when) low = mid + 1;
+		else high = mid;
+	}
+	return (low == 0 ? -1 : TierSlot(s, t, low - 1));
+}
+
+int bbStoreFind(psMessageType_enum messageType, time_t when, psMessage_t *msg, time_t *stamp)
+{
+	int reply = -1;
+	int t;
+
+	if (messageType < 0 || messageType >= PS_MSG_COUNT) return -1;
+
+	//critical section
+	int s = pthread_mutex_lock(&bbSeriesMtx[messageType]);
+	if (s != 0)
+	{
+		ERRORPRINT("bbStore: mutex lock %i\n", s);
+	}
+
+	bbSeries_t *series = bbSeries[messageType];
+
+	//tiers are newest first - the first with a sample old enough has the answer
+	for (t=0; series && t<BB_TIER_COUNT; t++)
+	{
+		int slot = TierSearch(series, t, when);
+		if (slot >= 0)
+		{
+			memcpy(msg, &series->message[slot], sizeof(psMessage_t));
+			if (stamp) *stamp = (time_t) series->stamp[slot];
+			reply = 0;
+			break;
+		}
+	}
+
+	s = pthread_mutex_unlock(&bbSeriesMtx[messageType]);
+	if (s != 0)
+	{
+		ERRORPRINT("bbStore: mutex unlock %i\n", s);
+	}
+	//end critical section
+
+	return reply;
+}
+
+int bbStoreLatest(psMessageType_enum messageType, psMessage_t *msg, time_t *stamp)
+{
+	uint32_t before, after = 0;
+	int64_t latestStamp;
+
+	if (messageType < 0 || messageType >= PS_MSG_COUNT) return -1;
+
+	bbLatest_t *latest = &bbLatest[messageType];
+
+	do
+	{
+		before = __atomic_load_n(&latest->sequence, __ATOMIC_ACQUIRE);
+		if (before == 0) return -1;
+		if (before & 1) continue;
+
+		latestStamp = latest->stamp;
+		memcpy(msg, &latest->message, sizeof(psMessage_t));
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		after = __atomic_load_n(&latest->sequence, __ATOMIC_RELAXED);
+	} while ((before & 1) || before != after);
+
+	if (stamp) *stamp = (time_t) latestStamp;
+	return 0;
+}
+
+//first sample in tier t at or after 'when' - count if none
+static uint32_t TierLower(bbSeries_t *s, int t, int64_t when)
+{
+	uint32_t low = 0;
+	uint32_t high = s->count[t];
+
+	while (low < high)
+	{
+		uint32_t mid = low + (high - low) / 2;
+		if (s->stamp[TierSlot(s, t, mid)] < when) low = mid + 1;
+		else high = mid;
+	}
+	return low;
+}
+
+//calls 'visit' for each sample from 'from' to 'to', oldest first - the type's lock is held
+typedef void (*Visitor_t)(psMessage_t *msg, int64_t stamp, void *arg);
+
+static int SeriesVisit(psMessageType_enum messageType, time_t from, time_t to, Visitor_t visit, void *arg)
+{
+	int visited = 0;
+	int t;
+	uint32_t i;
+
+	if (messageType < 0 || messageType >= PS_MSG_COUNT) return -1;
+
+	//critical section
+	int s = pthread_mutex_lock(&bbSeriesMtx[messageType]);
+	if (s != 0)
+	{
+		ERRORPRINT("bbStore: mutex lock %i\n", s);
+	}
+
+	bbSeries_t *series = bbSeries[messageType];
+
+	//the coarsest tier holds the oldest
+	for (t=BB_TIER_COUNT-1; series && t>=0; t--)
+	{
+		for (i=TierLower(series, t, from); i<series->count[t]; i++)
+		{
+			int slot = TierSlot(series, t, i);
+			if (series->stamp[slot] > to) break;
+			visit(&series->message[slot], series->stamp[slot], arg);
+			visited++;
+		}
+	}
+
+	s = pthread_mutex_unlock(&bbSeriesMtx[messageType]);
+	if (s != 0)
+	{
+		ERRORPRINT("bbStore: mutex unlock %i\n", s);
+	}
+	//end critical section
+
+	return visited;
+}
+
+typedef struct {
+	psMessage_t *msgs;
+	time_t *stamps;
+	int max;
+	int count;
+} RangeCopy_t;
+
+static void RangeVisitor(psMessage_t *msg, int64_t stamp, void *arg)
+{
+	RangeCopy_t *range = (RangeCopy_t*) arg;
+
+	if (range->count >= range->max) return;
+	memcpy(&range->msgs[range->count], msg, sizeof(psMessage_t));
+	if (range->stamps) range->stamps[range->count] = (time_t) stamp;
+	range->count++;
+}
+
+int bbStoreRange(psMessageType_enum messageType, time_t from, time_t to, psMessage_t *msgs, time_t *stamps, int max)
+{
+	RangeCopy_t range = {msgs, stamps, max, 0};
+
+	if (SeriesVisit(messageType, from, to, RangeVisitor, &range) < 0) return -1;
+	return range.count;
+}
+
+int bbStoreField(const char *name)
+{
+	int i;
+
+	for (i=0; i<bbFieldCount; i++)
+	{
+		if (strcmp(bbFields[i].name, name) == 0) return i;
+	}
+	return -1;
+}
+
+//a field's value as a double
+static double FieldValue(const bbField_t *field, const psMessage_t *msg)
+{
+	const uint8_t *p = (const uint8_t*) msg + field->offset;
+
+	switch (field->type)
+	{
+	case BB_FIELD_FLOAT:
+		if (field->size == sizeof(float))
+		{
+			float f;
+			memcpy(&f, p, sizeof(f));
+			return f;
+		}
+		else
+		{
+			double d;
+			memcpy(&d, p, sizeof(d));
+			return d;
+		}
+	case BB_FIELD_SIGNED:
+		switch (field->size)
+		{
+		case 1: return *(const int8_t*) p;
+		case 2: {int16_t v; memcpy(&v, p, 2); return v;}
+		case 4: {int32_t v; memcpy(&v, p, 4); return v;}
+		default: {int64_t v; memcpy(&v, p, 8); return (double) v;}
+		}
+	default:
+		switch (field->size)
+		{
+		case 1: return *p;
+		case 2: {uint16_t v; memcpy(&v, p, 2); return v;}
+		case 4: {uint32_t v; memcpy(&v, p, 4); return v;}
+		default: {uint64_t v; memcpy(&v, p, 8); return (double) v;}
+		}
+	}
+}
+
+typedef struct {
+	const bbField_t *field;
+	double *values;
+	time_t *stamps;
+	int max;
+	int count;
+} FieldCopy_t;
+
+static void FieldVisitor(psMessage_t *msg, int64_t stamp, void *arg)
+{
+	FieldCopy_t *range = (FieldCopy_t*) arg;
+
+	if (range->count >= range->max) return;
+	range->values[range->count] = FieldValue(range->field, msg);
+	if (range->stamps) range->stamps[range->count] = (time_t) stamp;
+	range->count++;
+}
+
+int bbStoreFieldRange(int field, time_t from, time_t to, double *values, time_t *stamps, int max)
+{
+	if (field < 0 || field >= bbFieldCount) return -1;
+
+	FieldCopy_t range = {&bbFields[field], values, stamps, max, 0};
+
+	if (SeriesVisit(bbFields[field].messageType, from, to, FieldVisitor, &range) < 0) return -1;
+	return range.count;
+}
+
+typedef struct {
+	const bbField_t *field;
+	bbAggregate_t *aggregate;
+	double sum;
+} Aggregating_t;
+
+static void AggregateVisitor(psMessage_t *msg, int64_t stamp, void *arg)
+{
+	Aggregating_t *a = (Aggregating_t*) arg;
+	bbAggregate_t *aggregate = a->aggregate;
+	double value = FieldValue(a->field, msg);
+
+	if (aggregate->count == 0 || value < aggregate->min) aggregate->min = value;
+	if (aggregate->count == 0 || value > aggregate->max) aggregate->max = value;
+	a->sum += value;
+	aggregate->last = value;
+	aggregate->lastStamp = (time_t) stamp;
+	aggregate->count++;
+}
+
+int bbStoreAggregate(int field, time_t from, time_t to, bbAggregate_t *aggregate)
+{
+	if (field < 0 || field >= bbFieldCount) return -1;
+
+	Aggregating_t a = {&bbFields[field], aggregate, 0.0};
+	memset(aggregate, 0, sizeof(bbAggregate_t));
+
+	if (SeriesVisit(bbFields[field].messageType, from, to, AggregateVisitor, &a) <= 0) return -1;
+	aggregate->mean = a.sum / aggregate->count;
+	return 0;
+}
@@ -0,0 +1,131 @@
+/*
+ * bbStore.h
+ *
+ * Blackboard history - a time series per message type
+ *
+ * Each type saved has a series of four ring buffer tiers, each holding samples at a coarser
+ * period for longer: everything for 10 seconds, then one a second for a minute, one a minute
+ * for an hour and one an hour for a day. Timestamps are kept in a column apart from the
+ * messages, so a lookup is a binary search over a few cache lines per tier.
+ *
+ * The series of all types are one fixed layout, mapped from a file so history survives a
+ * restart. Pages of types never saved are never touched, so they cost no memory.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: martin
+ */
+
+#ifndef BBSTORE_H_
+#define BBSTORE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "PubSubData.h"
+
+typedef enum {BB_TIER_RAW, BB_TIER_SECOND, BB_TIER_MINUTE, BB_TIER_HOUR, BB_TIER_COUNT} bbTier_enum;
+
+//tier sizes - powers of 2, at least retention / period
+#define BB_RAW_SLOTS		64			//10 seconds of everything
+#define BB_SECOND_SLOTS		64
+#define BB_MINUTE_SLOTS		64
+#define BB_HOUR_SLOTS		32
+#define BB_SERIES_SLOTS		(BB_RAW_SLOTS + BB_SECOND_SLOTS + BB_MINUTE_SLOTS + BB_HOUR_SLOTS)
+
+typedef struct {
+	char *name;
+	int slots;
+	int base;						//first slot in the series columns
+	int period;						//seconds per sample kept, 0 = all
+	int retention;					//seconds before a sample moves to the next tier
+} bbTierSpec_t;
+
+extern const bbTierSpec_t bbTiers[BB_TIER_COUNT];
+
+//latest value of a type - read without a lock (see bbStoreLatest)
+typedef struct {
+	uint32_t sequence;						//odd while being written, 0 = never
+	int64_t stamp;
+	psMessage_t message;
+} __attribute__((aligned(64))) bbLatest_t;
+
+//fixed layout - tier t occupies slots base..base+slots-1 of each column
+typedef struct {
+	uint32_t sequence;						//odd while a save is changing the series
+	uint32_t head[BB_TIER_COUNT];			//next slot to write, free running
+	uint32_t count[BB_TIER_COUNT];
+	int64_t stamp[BB_SERIES_SLOTS];			//seconds since the epoch
+	psMessage_t message[BB_SERIES_SLOTS];
+} bbSeries_t;
+
+//history file - a header, then a series for every type
+#define BB_HISTORY_MAGIC	0x62624853		//"bbHS"
+#define BB_HISTORY_VERSION	1
+
+typedef struct {
+	uint32_t magic;							//written last when the file is made
+	uint32_t version;
+	uint32_t types;							//PS_MSG_COUNT
+	uint32_t seriesSize;					//sizeof(bbSeries_t)
+	uint32_t formats;						//hash of each type's message format
+	uint32_t spare[11];
+} bbHistoryHeader_t;
+
+typedef struct {
+	bbHistoryHeader_t header;
+	bbSeries_t series[PS_MSG_COUNT];
+} bbHistory_t;
+
+//a named numeric payload field - see BlackboardFields.h
+typedef enum {BB_FIELD_FLOAT, BB_FIELD_SIGNED, BB_FIELD_UNSIGNED} bbFieldType_enum;
+
+typedef struct {
+	char *name;
+	psMessageType_enum messageType;
+	int offset;								//in psMessage_t
+	int size;
+	bbFieldType_enum type;
+} bbField_t;
+
+extern const bbField_t bbFields[];
+extern const int bbFieldCount;
+
+//aggregate of a field over the samples kept in a window
+typedef struct {
+	int count;
+	double min;
+	double max;
+	double mean;
+	double last;
+	time_t lastStamp;
+} bbAggregate_t;
+
+//map the history - from 'path' if not NULL, reloading what an earlier run left there
+int bbStoreInit(const char *path);
+
+//append a message to its type's series, ageing the series to 'stamp'
+int bbStoreSave(psMessage_t *msg, time_t stamp);
+
+//copy out the newest sample at or before 'when'. -1 if there is none
+int bbStoreFind(psMessageType_enum messageType, time_t when, psMessage_t *msg, time_t *stamp);
+
+//copy out the samples from 'from' to 'to', oldest first - returns how many, at most 'max'
+//older samples are the ones kept by the coarser tiers
+int bbStoreRange(psMessageType_enum messageType, time_t from, time_t to, psMessage_t *msgs, time_t *stamps, int max);
+
+//index in bbFields[] of a field, -1 if not listed
+int bbStoreField(const char *name);
+
+//values of a field from 'from' to 'to', oldest first - returns how many, at most 'max'
+int bbStoreFieldRange(int field, time_t from, time_t to, double *values, time_t *stamps, int max);
+
+//min/max/mean/last of a field from 'from' to 'to', computed in place. -1 if no samples
+//the mean is over the samples kept - one per second, minute or hour further back
+int bbStoreAggregate(int field, time_t from, time_t to, bbAggregate_t *aggregate);
+
+//copy out the newest sample without taking a lock. -1 if there is none
+//never waits on a save - retries only if a save of the same type overlaps the copy
+int bbStoreLatest(psMessageType_enum messageType, psMessage_t *msg, time_t *stamp);
+
+#endif /* BBSTORE_H_ */
@@ -0,0 +1,12 @@
+//
+//  BlackboardFields.h
+//
+//  Bench stand-in for the robot's list of queryable fields
+//
+
+//fieldmacro(name, messageType, member)
+
+fieldmacro("odometry.value", ODOMETRY, benchPayload.value)
+fieldmacro("odometry.seq", ODOMETRY, benchPayload.seq)
+fieldmacro("odometry.sent", ODOMETRY, benchPayload.sent)
+fieldmacro("notification.value", NOTIFICATION, intPayload.value)
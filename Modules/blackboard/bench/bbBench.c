@@ -0,0 +1,443 @@
+/*
+ ============================================================================
+ Name        : bbBench.c
+ Author      : Martin
+ Description : Host benchmark for the blackboard history store. Saves a
+ simulated day of samples on a simulated clock, then checks lookups against
+ a brute force search of what was kept and reports save and lookup times.
+ Saves age the tiers as they go, so their cost should not grow with history.
+ Range and aggregate queries over random windows are checked the same way,
+ and notifications are read back by field name as Notify sends them.
+ Given a history file, it then reloads the file as a restart would and
+ checks the lookups again, that the latest values start empty, that a clock
+ behind the history keeps it, that a save cut short is cleared and that a
+ file cut short is started afresh. Last, reader threads poll the latest
+ value while a writer saves flat out, checking each copy is whole.
+ ============================================================================
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "PubSubData.h"
+#include "bbStore.h"
+
+FILE *bbDebugFile;
+
+extern bbSeries_t *bbSeries[PS_MSG_COUNT];
+
+//run parameters
+int rate = 2;					//samples/sec
+int duration = 24 * 3600;		//simulated seconds
+int lookups = 100000;
+int readers = 2;
+int seconds = 1;						//of the latest value test
+char *historyFile = NULL;
+
+volatile bool running;
+
+uint64_t BenchNow()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+//newest kept sample at or before 'when', by scanning every slot
+int64_t BruteForce(bbSeries_t *s, int64_t when)
+{
+	int64_t best = -1;
+	int t;
+	uint32_t i;
+
+	for (t=0; t<BB_TIER_COUNT; t++)
+	{
+		for (i=0; i<s->count[t]; i++)
+		{
+			int slot = bbTiers[t].base + (int)((s->head[t] - s->count[t] + i) & (bbTiers[t].slots - 1));
+			if (s->stamp[slot] <= when && s->stamp[slot] > best) best = s->stamp[slot];
+		}
+	}
+	return best;
+}
+
+//latest value test - every payload word of a save holds its sequence number
+typedef struct {
+	long reads;
+	long torn;
+	uint64_t ns;
+} Reader_t;
+
+void *WriterThread(void *arg)
+{
+	psMessage_t msg;
+	uint32_t seq = 0;
+	int k;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.header.messageType = ODOMETRY;
+	msg.header.length = PS_MAX_PAYLOAD;
+
+	while (running)
+	{
+		seq++;
+		for (k=0; k<PS_MAX_PAYLOAD / 4; k++) memcpy(&msg.packet[k * 4], &seq, 4);
+		bbStoreSave(&msg, time(NULL));
+		*(long*) arg += 1;
+	}
+	return NULL;
+}
+
+void *ReaderThread(void *arg)
+{
+	Reader_t *r = (Reader_t*) arg;
+	psMessage_t msg;
+	uint32_t first, word;
+	int k;
+
+	while (running)
+	{
+		uint64_t t0 = BenchNow();
+		int found = bbStoreLatest(ODOMETRY, &msg, NULL);
+		r->ns += BenchNow() - t0;
+		if (found < 0) continue;
+		r->reads++;
+
+		memcpy(&first, msg.packet, 4);
+		for (k=1; k<PS_MAX_PAYLOAD / 4; k++)
+		{
+			memcpy(&word, &msg.packet[k * 4], 4);
+			if (word != first)
+			{
+				r->torn++;
+				break;
+			}
+		}
+	}
+	return NULL;
+}
+
+int LatestTest()
+{
+	pthread_t writer, reader[16];
+	Reader_t r[16];
+	long saves = 0, reads = 0, torn = 0;
+	uint64_t ns = 0;
+	int i;
+
+	memset(r, 0, sizeof(r));
+	running = true;
+	pthread_create(&writer, NULL, WriterThread, &saves);
+	for (i=0; i<readers; i++) pthread_create(&reader[i], NULL, ReaderThread, &r[i]);
+
+	sleep(seconds);
+	running = false;
+
+	pthread_join(writer, NULL);
+	for (i=0; i<readers; i++)
+	{
+		pthread_join(reader[i], NULL);
+		reads += r[i].reads;
+		torn += r[i].torn;
+		ns += r[i].ns;
+	}
+	printf("latest: %i readers, %li saves, %li reads at %.0f nS, %li torn\n",
+			readers, saves, reads, (reads ? (double) ns / reads : 0.0), torn);
+	return (torn ? 1 : 0);
+}
+
+//lookups across the day, against the brute force answer
+int Lookups(time_t now)
+{
+	psMessage_t msg;
+	time_t stamp;
+	uint64_t findNs = 0;
+	int i, wrong = 0;
+
+	bbSeries_t *s = bbSeries[ODOMETRY];
+	srand(1);
+	for (i=0; i<lookups; i++)
+	{
+		time_t when = now - (rand() % (duration + 60));
+		uint64_t t0 = BenchNow();
+		int found = bbStoreFind(ODOMETRY, when, &msg, &stamp);
+		findNs += BenchNow() - t0;
+
+		int64_t expected = BruteForce(s, when);
+		if ((found < 0 && expected >= 0) || (found == 0 && (stamp != expected || msg.benchPayload.sent != (uint64_t) stamp)))
+		{
+			if (wrong++ < 5)
+			{
+				fprintf(stderr, "lookup %li: found %i stamp %li, expected %lli\n",
+						(long) when, found, (long) stamp, (long long) expected);
+			}
+		}
+	}
+	printf("find: %.0f nS mean, %i wrong of %i\n", (double) findNs / lookups, wrong, lookups);
+	return wrong;
+}
+
+//range and aggregate queries over random windows, against the brute force answer
+int Queries(time_t now)
+{
+	static psMessage_t msgs[BB_SERIES_SLOTS];
+	time_t stamps[BB_SERIES_SLOTS];
+	int64_t kept[BB_SERIES_SLOTS];
+	bbAggregate_t aggregate;
+	uint64_t rangeNs = 0, aggregateNs = 0;
+	int i, k, t, wrong = 0;
+	uint32_t j;
+
+	bbSeries_t *s = bbSeries[ODOMETRY];
+	int field = bbStoreField("odometry.seq");
+	if (field < 0 || bbStoreField("no.such.field") >= 0)
+	{
+		fprintf(stderr, "field lookup wrong\n");
+		return 1;
+	}
+
+	srand(2);
+	for (i=0; i<lookups / 10; i++)
+	{
+		time_t from = now - (rand() % (duration + 60));
+		time_t to = from + (rand() % 7200);
+
+		//everything kept in the window, oldest first - tiers don't overlap
+		int expected = 0;
+		for (t=BB_TIER_COUNT-1; t>=0; t--)
+		{
+			for (j=0; j<s->count[t]; j++)
+			{
+				int slot = bbTiers[t].base + (int)((s->head[t] - s->count[t] + j) & (bbTiers[t].slots - 1));
+				if (s->stamp[slot] >= from && s->stamp[slot] <= to) kept[expected++] = slot;
+			}
+		}
+
+		uint64_t t0 = BenchNow();
+		int count = bbStoreRange(ODOMETRY, from, to, msgs, stamps, BB_SERIES_SLOTS);
+		rangeNs += BenchNow() - t0;
+
+		bool ok = (count == expected);
+		for (k=0; ok && k<count; k++)
+		{
+			ok = (stamps[k] == s->stamp[kept[k]] && msgs[k].benchPayload.seq == s->message[kept[k]].benchPayload.seq);
+		}
+
+		t0 = BenchNow();
+		int found = bbStoreAggregate(field, from, to, &aggregate);
+		aggregateNs += BenchNow() - t0;
+
+		if (expected == 0) ok = ok && (found < 0);
+		else
+		{
+			double min = 1e300, max = -1e300, sum = 0;
+			for (k=0; k<expected; k++)
+			{
+				double v = s->message[kept[k]].benchPayload.seq;
+				if (v < min) min = v;
+				if (v > max) max = v;
+				sum += v;
+			}
+			ok = ok && found == 0 && aggregate.count == expected && aggregate.min == min && aggregate.max == max
+					&& aggregate.mean == sum / expected
+					&& aggregate.last == s->message[kept[expected - 1]].benchPayload.seq
+					&& aggregate.lastStamp == s->stamp[kept[expected - 1]];
+		}
+
+		if (!ok && wrong++ < 5)
+		{
+			fprintf(stderr, "query %li..%li: range %i aggregate %i count %i, expected %i\n",
+					(long) from, (long) to, count, found, aggregate.count, expected);
+		}
+	}
+	printf("range: %.0f nS mean, aggregate: %.0f nS mean, %i wrong of %i\n",
+			(double) rangeNs / (lookups / 10), (double) aggregateNs / (lookups / 10), wrong, lookups / 10);
+	return wrong;
+}
+
+//notifications saved as Notify and CancelNotification send them, read back by field name
+int Notifications(time_t now)
+{
+	int values[] = {MOTORS_STARTING, MOTORS_DONE, -MOTORS_STARTING};
+	double kept[BB_SERIES_SLOTS];
+	time_t stamps[BB_SERIES_SLOTS];
+	psMessage_t msg;
+	int i, wrong = 0;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.header.messageType = NOTIFICATION;
+	msg.header.length = sizeof(psIntPayload_t);
+
+	for (i=0; i<3; i++)
+	{
+		msg.intPayload.value = values[i];
+		bbStoreSave(&msg, now - 2 + i);
+	}
+
+	int count = bbStoreFieldRange(bbStoreField("notification.value"), now - 2, now, kept, stamps, BB_SERIES_SLOTS);
+	if (count != 3) wrong++;
+	for (i=0; i<count && i<3; i++)
+	{
+		if (kept[i] != values[i] || stamps[i] != now - 2 + i) wrong++;
+	}
+	printf("notification.value: %i of 3 read back, %i wrong\n", count, wrong);
+	return wrong;
+}
+
+void Usage(char *name)
+{
+	fprintf(stderr, "usage: %s [-r samples/sec] [-d seconds] [-n lookups] [-t readers] [-s seconds] [-f history file]\n", name);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	psMessage_t msg;
+	time_t start = 1700000000;
+	time_t now, stamp;
+	int opt, i, t;
+	int wrong = 0;
+
+	while ((opt = getopt(argc, argv, "r:d:n:t:s:f:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'r':
+			rate = atoi(optarg);
+			break;
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		case 'n':
+			lookups = atoi(optarg);
+			break;
+		case 't':
+			readers = atoi(optarg);
+			break;
+		case 's':
+			seconds = atoi(optarg);
+			break;
+		case 'f':
+			historyFile = optarg;
+			break;
+		default:
+			Usage(argv[0]);
+			break;
+		}
+	}
+	if (rate < 1 || duration < 1 || lookups < 10 || readers < 1 || readers > 16 || seconds < 1) Usage(argv[0]);
+
+	bbDebugFile = stderr;
+	if (historyFile) unlink(historyFile);
+	if (bbStoreInit(historyFile) < 0) return 1;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.header.messageType = ODOMETRY;
+	msg.header.length = sizeof(psBenchPayload_t);
+
+	//save - timed separately for the first and last hours
+	uint64_t firstNs = 0, lastNs = 0, maxNs = 0;
+	long firstCount = 0, lastCount = 0;
+
+	for (now = start; now < start + duration; now++)
+	{
+		for (i=0; i<rate; i++)
+		{
+			msg.benchPayload.seq++;
+			msg.benchPayload.sent = (uint64_t) now;
+
+			uint64_t t0 = BenchNow();
+			bbStoreSave(&msg, now);
+			uint64_t ns = BenchNow() - t0;
+
+			if (ns > maxNs) maxNs = ns;
+			if (now - start < 3600)
+			{
+				firstNs += ns;
+				firstCount++;
+			}
+			if (start + duration - now <= 3600)
+			{
+				lastNs += ns;
+				lastCount++;
+			}
+		}
+	}
+	now--;
+
+	bbSeries_t *s = bbSeries[ODOMETRY];
+	printf("%i samples/sec for %i s\n", rate, duration);
+	for (t=0; t<BB_TIER_COUNT; t++)
+	{
+		printf("  %-7s %4u kept\n", bbTiers[t].name, s->count[t]);
+	}
+	printf("save: %.0f nS mean first hour, %.0f nS mean last hour, %llu nS max\n",
+			(firstCount ? (double) firstNs / firstCount : 0.0),
+			(lastCount ? (double) lastNs / lastCount : 0.0),
+			(unsigned long long) maxNs);
+
+	wrong += Lookups(now);
+	wrong += Queries(now);
+	wrong += Notifications(now);
+
+	if (historyFile)
+	{
+		//restart - the same history from the file
+		uint64_t t0 = BenchNow();
+		bbStoreInit(historyFile);
+		printf("reload: %.0f uS\n", (BenchNow() - t0) / 1000.0);
+
+		//the last run's values are history, not current
+		if (bbStoreLatest(ODOMETRY, &msg, &stamp) == 0)
+		{
+			fprintf(stderr, "latest value reloaded\n");
+			wrong++;
+		}
+		wrong += Lookups(now);
+
+		//booted with the clock unset - the history stays, the save goes at its newest stamp
+		bbStoreSave(&msg, start - 365 * 24 * 3600);
+		if (bbStoreLatest(ODOMETRY, &msg, &stamp) < 0 || stamp != now || bbStoreFind(ODOMETRY, now - 3600, &msg, NULL) < 0)
+		{
+			fprintf(stderr, "history lost to a clock behind it\n");
+			wrong++;
+		}
+		else printf("clock behind: history kept\n");
+
+		//killed mid save - the series is cleared rather than trusted
+		bbSeries[ODOMETRY]->sequence |= 1;
+		bbStoreInit(historyFile);
+		if (bbStoreFind(ODOMETRY, now, &msg, NULL) == 0 || bbStoreLatest(ODOMETRY, &msg, NULL) == 0)
+		{
+			fprintf(stderr, "interrupted series kept\n");
+			wrong++;
+		}
+		else printf("interrupted save: series cleared\n");
+
+		//a file cut short - started afresh rather than mapped past its end
+		bbStoreSave(&msg, now);
+		if (truncate(historyFile, sizeof(bbHistory_t) / 2) < 0 || bbStoreInit(historyFile) < 0
+				|| bbStoreFind(ODOMETRY, now, &msg, NULL) == 0)
+		{
+			fprintf(stderr, "short file kept\n");
+			wrong++;
+		}
+		else
+		{
+			bbStoreSave(&msg, now);
+			bbSeries[PS_MSG_COUNT - 1]->count[0] = 0;		//touches the last page
+			printf("short file: started afresh\n");
+		}
+	}
+
+	if (LatestTest()) wrong++;
+
+	return (wrong ? 1 : 0);
+}
@@ -22,17 +22,10 @@
 
 #include "blackboard.h"
 #include "blackboardData.h"
+#include "blackboardDebug.h"
 
 FILE *bbDebugFile;
 
-#ifdef BLACKBOARD_DEBUG
-#define DEBUGPRINT(...) fprintf(stdout, __VA_ARGS__);fprintf(bbDebugFile, __VA_ARGS__);fflush(bbDebugFile);
-#else
-#define DEBUGPRINT(...) fprintf(bbDebugFile, __VA_ARGS__);fflush(bbDebugFile);
-#endif
-
-#define ERRORPRINT(...) fprintf(stdout, __VA_ARGS__);fprintf(bbDebugFile, __VA_ARGS__);fflush(bbDebugFile);
-
 
 char *eventNames[] = NOTIFICATION_NAMES;
 char *stateCommandNames[] = USER_COMMAND_NAMES;
@@ -41,8 +34,7 @@ char *ovmCommandNames[] = OVERMIND_COMMAND_NAMES;
 char *arbStateNames[]	= ARB_STATE_NAMES;
 
 //---------------------------------------Blackboard Data Implementation--------------------------------
-
-RawBlackboardData_t *rawBlackboardData[PS_MSG_COUNT];
+//history is kept in bbStore.c
 
 //options
 #define optionmacro(name, var, min, max, def) int var = def;
@@ -56,21 +48,19 @@ RawBlackboardData_t *rawBlackboardData[PS_MSG_COUNT];
 
 //-----------------------------------------Blackboard Memory Management--------------
 
-RawBlackboardData_t *bbFreelist = NULL;					//common free list
+RawBlackboardData_t *bbFreelist = NULL;					//reader copies free list
 pthread_mutex_t	bbFreeMtx = PTHREAD_MUTEX_INITIALIZER;	//freelist mutex
 BrokerQueue_t blackboardQueue = BROKER_Q_INITIALIZER;
 
 //private
-int bbAddToMsgList(RawBlackboardData_t *e);
 RawBlackboardData_t *bbNewEntry();
 void bbAddToFreelist(RawBlackboardData_t *e);
 void _bbAddToFreelist(RawBlackboardData_t *e);			//called from critical section
 RawBlackboardData_t *bbGetFreeEntry();
 
-#define BB_MEMORY_PRELOAD 	(30 * 60)
+#define BB_MEMORY_PRELOAD 	8		//copies out to readers at once
 //---------------------------------------------------
-//threads to manage blackboard
-void *BlackboardThread(void *arg);
+//thread to manage blackboard
 void *BlackboardMessageThread(void *arg);
 
 pthread_t BlackboardInit()
@@ -78,11 +68,13 @@ pthread_t BlackboardInit()
 	bbDebugFile = fopen("/root/logfiles/blackboard.log", "w");
 
 	int i;
-	//initialize the message store
-	for (i=0; i<PS_MSG_COUNT; i++)
-	{
-		rawBlackboardData[i] = (RawBlackboardData_t *) 0;
-	}
+	//initialize the message store - reloading the last run's history
+#ifdef BB_HISTORY_FILE
+	if (bbStoreInit(BB_HISTORY_FILE) < 0) return -1;
+#else
+	if (bbStoreInit(NULL) < 0) return -1;
+#endif
+
 	//preload the freelist
 	for (i=0; i<BB_MEMORY_PRELOAD; i++)
 	{
@@ -91,16 +83,20 @@ pthread_t BlackboardInit()
 		_bbAddToFreelist(entry);
 	}
 
+	SetQueueCoalesce(&blackboardQueue, TICK_1S);
+	psRegisterQueueStats(&blackboardQueue, "blackboard");
+
+	//messages saved or acted on - read-only, so shared rather than copied
+	psSubscribeQueue(TICK_1S, &blackboardQueue);
+	psSubscribeQueue(BATTERY, &blackboardQueue);
+	psSubscribeQueue(ENVIRONMENT, &blackboardQueue);
+	psSubscribeQueue(NOTIFICATION, &blackboardQueue);
+	psSubscribeQueue(NEW_SETTING, &blackboardQueue);
+	psSubscribeQueue(SET_OPTION, &blackboardQueue);
+
 	//create blackboard thread
 	pthread_t thread;
-	int result = pthread_create(&thread, NULL, BlackboardThread, NULL);
-	if (result != 0)
-	{
-		ERRORPRINT("No Blackboard thread\n");
-		return -1;
-	}
-
-	result = pthread_create(&thread, NULL, BlackboardMessageThread, NULL);
+	int result = pthread_create(&thread, NULL, BlackboardMessageThread, NULL);
 	if (result != 0)
 	{
 		ERRORPRINT("No BlackboardMessageThread thread\n");
@@ -110,102 +106,6 @@ pthread_t BlackboardInit()
 	return thread;
 }
 
-//--------------------------------------------------Blackboard thread
-void *BlackboardThread(void *arg)
-{
-	int messageType = 0;
-	RawBlackboardData_t *d, *parent;
-	struct tm current, last;
-	time_t now;
-	bool discard;
-	while (1)
-	{
-		sleep (1);
-		parent = NULL;
-		now = time(NULL);
-
-		//garbage collect one message type
-		//critical section
-		int s = pthread_mutex_lock(&bbFreeMtx);
-		if (s != 0)
-		{
-			ERRORPRINT("BB Thread:  mutex lock %i\n", s);
-		}
-
-		d = rawBlackboardData[messageType];
-		if (d)
-		{
-			localtime_r(&d->timeStamp, &last);
-		}
-		while (d)
-		{
-			discard = false;
-			localtime_r(&d->timeStamp, &current);
-
-			int age = now - d->timeStamp;
-			if (age < 10)
-			{
-				//keep all
-			}
-			else if (age < 60)
-			{
-				//keep 1 per second, for a minute
-				if (last.tm_sec == current.tm_sec && last.tm_min == current.tm_min && last.tm_hour == current.tm_hour)
-				{
-					discard = true;
-				}
-			}
-			else if (age < 3600)
-			{
-				//keep 1 per minute, for an hour
-				if (last.tm_min == current.tm_min && last.tm_hour == current.tm_hour)
-				{
-					discard = true;
-				}
-			}
-			else if (age < 3600 * 24)
-			{
-				//keep one per hour, for a day
-				if (last.tm_hour == current.tm_hour)
-				{
-					discard = true;
-				}
-			}
-			else
-			{
-				//discard all over 24 hours
-				discard = true;
-			}
-
-			if (discard & d->accessCount == 0)
-			{
-				if (parent)
-				{
-					parent->next = d->next;
-				}
-				else
-				{
-					rawBlackboardData[messageType] = d->next;
-				}
-				_bbAddToFreelist(d);
-			}
-			else
-			{
-				parent = d;
-				localtime_r(&d->timeStamp, &last);
-			}
-			d = (RawBlackboardData_t *) d->next;
-		}
-
-		s = pthread_mutex_unlock(&bbFreeMtx);
-		if (s != 0)
-		{
-			ERRORPRINT("BB Thread:  mutex unlock %i\n", s);
-		}
-		//end critical section
-	}
-}
-
 //--------------------------------------------------update Blackboard
 
 void BlackboardProcessMessage(psMessage_t *msg)
@@ -215,30 +115,29 @@ void BlackboardProcessMessage(psMessage_t *msg)
 
 void *BlackboardMessageThread(void *arg)
 {
+	psMessage_t *batch[BROKER_Q_BATCH];
+	int batchCount = 0;
+	int batchNext = 0;
+
 	DEBUGPRINT("Blackboard message thread started\n");
 
 	while (1)
 	{
 		bool saveMessage = false;
 
-		psMessage_t *msg = GetNextMessage(&blackboardQueue);
+		//take pending messages a batch at a time
+		if (batchNext == batchCount)
+		{
+			batchCount = GetNextMessages(&blackboardQueue, batch, BROKER_Q_BATCH, -1);
+			batchNext = 0;
+		}
+		psMessage_t *msg = batch[batchNext++];
 		switch (msg->header.messageType)
 		{
 		case TICK_1S:
-		{
-			RawBlackboardData_t *e = rawBlackboardData[TICK_1S];
-			if (e)
-			{
-				//update existing tick message
-				memcpy(&e->message, msg, sizeof(psMessage_t));
-				e->timeStamp = time(NULL);
-			}
-			else
-			{
-				saveMessage = true;
-			}
-		}
-		break;
+			//history is bounded by the store - ticks keep the notifications record
+			saveMessage = true;
+			break;
 		case PING_RESPONSE:
 		case PING_MSG:
 		case GEN_STATS:
@@ -281,53 +180,43 @@ void *BlackboardMessageThread(void *arg)
 
 		if (saveMessage)
 		{
-			RawBlackboardData_t *e = bbGetFreeEntry();
-
-			if (!e)
-			{
-				ERRORPRINT("Blackboard: No memory\n");
-			}
-			else
+			if (bbStoreSave(msg, time(NULL)) < 0)
 			{
-				memcpy(&e->message, msg, sizeof(psMessage_t));
-
-				e->timeStamp = time(NULL);
-				e->accessCount = 0;
-
-				if (bbAddToMsgList(e) < 0)
-				{
-					//failed
-					ERRORPRINT("Blackboard: Add failed\n");
-					bbAddToFreelist(e);
-				}
+				ERRORPRINT("Blackboard: Add failed\n");
 			}
 		}
 		DoneWithMessage(msg);
 	}
 }
 //-------------------------------------Access to data
-//get a pointer to a message - current or 'relativeTime' seconds in the past
-psMessage_t *bbGetMessage(psMessageType_enum messageType, time_t timespec)
+//absolute time, or 'timespec' seconds before now if it is zero or negative
+static time_t bbRequiredTime(time_t timespec, time_t timeNow)
 {
-	RawBlackboardData_t *d ;
-	time_t timeNow, timeRequired;
-
-	timeNow = time(NULL);
-
 	if (timespec > 0)
 	{
 		//absolute time
-		timeRequired = timespec;
+		return timespec;
 	} else if (timespec <= 0 && timeNow > 0)
 	{
 		//relative time
-		timeRequired = time(NULL) + timespec;
+		return timeNow + timespec;
 	}
 	else
 	{
 		//fallback
-		timeRequired = 0;
+		return 0;
 	}
+}
+
+//get a pointer to a message - current or 'relativeTime' seconds in the past
+//the message is a copy, so the store never waits for the reader
+psMessage_t *bbGetMessage(psMessageType_enum messageType, time_t timespec)
+{
+	RawBlackboardData_t *d ;
+	time_t timeNow, timeRequired;
+
+	timeNow = time(NULL);
+	timeRequired = bbRequiredTime(timespec, timeNow);
 
 	if (messageType >= PS_MSG_COUNT || messageType <= 0)
 	{
@@ -335,29 +224,23 @@ psMessage_t *bbGetMessage(psMessageType_enum messageType, time_t timespec)
 		return NULL;
 	}
 
-	//critical section
-	int s = pthread_mutex_lock(&bbFreeMtx);
-	if (s != 0)
-	{
-		ERRORPRINT("Blackboard:  mutex lock %i\n", s);
-	}
-
-	d = rawBlackboardData[messageType];
+	d = bbGetFreeEntry();
+	if (d == NULL) return NULL;
 
-	while (d && d->timeStamp > timeRequired)
-	{
-		d = (RawBlackboardData_t *) d->next;
-	}
-	if (d)
+	//the current value needs no search
+	if (timeRequired >= timeNow)
 	{
-		d->accessCount++;
+		if (bbStoreLatest(messageType, &d->message, &d->timeStamp) < 0)
+		{
+			bbAddToFreelist(d);
+			return NULL;
+		}
 	}
-	s = pthread_mutex_unlock(&bbFreeMtx);
-	if (s != 0)
+	else if (bbStoreFind(messageType, timeRequired, &d->message, &d->timeStamp) < 0)
 	{
-		ERRORPRINT("Blackboard:  mutex unlock %i\n", s);
+		bbAddToFreelist(d);
+		return NULL;
 	}
-	//end critical section
 
 	return (psMessage_t*) d;
 }
@@ -369,19 +252,65 @@ time_t bbGetTimeStamp(psMessage_t *msg)
 	return d->timeStamp;
 }
 
-//release the message for GC
+//return the copy
 void bbDoneWithData(psMessage_t *msg)
 {
-	RawBlackboardData_t *d = (RawBlackboardData_t*) msg;
-	d->accessCount--;
+	bbAddToFreelist((RawBlackboardData_t*) msg);
+}
+
+//copy the latest message of a type into 'msg' - never blocks
+bool bbGetLatest(psMessageType_enum messageType, psMessage_t *msg, time_t *timeStamp)
+{
+	return (bbStoreLatest(messageType, msg, timeStamp) == 0);
+}
+
+//copy messages from 'from' to 'to' (as bbGetMessage) into 'msgs', oldest first
+int bbGetRange(psMessageType_enum messageType, time_t from, time_t to, psMessage_t *msgs, time_t *timeStamps, int max)
+{
+	time_t timeNow = time(NULL);
+
+	if (messageType >= PS_MSG_COUNT || messageType <= 0)
+	{
+		ERRORPRINT("Blackboard: bad message type: %i\n", messageType);
+		return -1;
+	}
+	return bbStoreRange(messageType, bbRequiredTime(from, timeNow), bbRequiredTime(to, timeNow), msgs, timeStamps, max);
+}
+
+//aggregate a named field (BlackboardFields.h) from 'from' to 'to'
+bool bbGetAggregate(const char *fieldName, time_t from, time_t to, bbAggregate_t *aggregate)
+{
+	time_t timeNow = time(NULL);
+	int field = bbStoreField(fieldName);
+
+	if (field < 0)
+	{
+		ERRORPRINT("Blackboard: no field %s\n", fieldName);
+		return false;
+	}
+	return (bbStoreAggregate(field, bbRequiredTime(from, timeNow), bbRequiredTime(to, timeNow), aggregate) == 0);
+}
+
+//values of a named field from 'from' to 'to', oldest first
+int bbGetFieldRange(const char *fieldName, time_t from, time_t to, double *values, time_t *timeStamps, int max)
+{
+	time_t timeNow = time(NULL);
+	int field = bbStoreField(fieldName);
+
+	if (field < 0)
+	{
+		ERRORPRINT("Blackboard: no field %s\n", fieldName);
+		return -1;
+	}
+	return bbStoreFieldRange(field, bbRequiredTime(from, timeNow), bbRequiredTime(to, timeNow), values, timeStamps, max);
 }
 
 //notifications
 NotificationMask_t bbGetActiveNotifications()
 {
-	RawBlackboardData_t *latestTick = rawBlackboardData[TICK_1S];
+	psMessage_t latestTick;
 
-	if (latestTick) return latestTick->message.tickPayload.activeNotifications;
+	if (bbGetLatest(TICK_1S, &latestTick, NULL)) return latestTick.tickPayload.activeNotifications;
 	else return 0;
 }
 
@@ -402,36 +331,6 @@ RawBlackboardData_t *bbNewEntry()
 	}
 	return e;
 }
-//add to the front of a data list
-int bbAddToMsgList(RawBlackboardData_t *e)
-{
-	int msgType = e->message.header.messageType;
-
-	if (msgType >= PS_MSG_COUNT)
-	{
-		ERRORPRINT("Blackboard: bad message type: %i\n", msgType);
-		return -1;
-	}
-
-	//critical section
-	int s = pthread_mutex_lock(&bbFreeMtx);
-	if (s != 0)
-	{
-		ERRORPRINT("Blackboard:  mutex lock %i\n", s);
-	}
-
-	e->next = rawBlackboardData[msgType];
-	rawBlackboardData[msgType] = e;
-
-	s = pthread_mutex_unlock(&bbFreeMtx);
-	if (s != 0)
-	{
-		ERRORPRINT("Blackboard:  mutex unlock %i\n", s);
-	}
-	//end critical section
-	return 0;
-}
-
 //free a used entry
 void bbAddToFreelist(RawBlackboardData_t *e)
 {
@@ -12,6 +12,7 @@
 #include <sys/time.h>
 #include "PubSubData.h"
 #include "pubsub/pubsub.h"
+#include "bbStore.h"
 
 //options
 #define optionmacro(name, var, min, max, def) extern int var;
@@ -41,9 +42,24 @@ psMessage_t *bbGetMessage(psMessageType_enum messageType, time_t relativeTime);
 //get timestamp
 time_t bbGetTimeStamp(psMessage_t *msg);
 
-//release the message for GC
+//release the message
 void bbDoneWithData(psMessage_t *msg);
 
+//copy the latest message of a type into 'msg', without waiting on the blackboard
+//false if none has been saved
+bool bbGetLatest(psMessageType_enum messageType, psMessage_t *msg, time_t *timeStamp);
+
+//copy the messages of a type from 'from' to 'to' (times as bbGetMessage), oldest first
+//returns how many, at most 'max' - further back the samples are one a second, minute or hour
+int bbGetRange(psMessageType_enum messageType, time_t from, time_t to, psMessage_t *msgs, time_t *timeStamps, int max);
+
+//values of a field named in BlackboardFields.h from 'from' to 'to', oldest first
+int bbGetFieldRange(const char *fieldName, time_t from, time_t to, double *values, time_t *timeStamps, int max);
+
+//min/max/mean/last of a field named in BlackboardFields.h from 'from' to 'to'
+//false if the field is unknown or has no samples in the window
+bool bbGetAggregate(const char *fieldName, time_t from, time_t to, bbAggregate_t *aggregate);
+
 //notifications
 NotificationMask_t bbGetActiveNotifications();
 bool bbIsNotificationActive(Notification_enum e);
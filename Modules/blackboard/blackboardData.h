@@ -9,17 +9,13 @@
 #define BLACKBOARDDATA_H_
 
 #include "blackboard.h"
+#include "bbStore.h"
 
-//latest reports
-
+//a message copied out of the store for a reader - returned by bbDoneWithData
 typedef struct {
 	psMessage_t message;
 	time_t timeStamp;
 	void *next;
-	int accessCount;
 } RawBlackboardData_t;
 
-//define a pointer for each message type
-extern RawBlackboardData_t *rawBlackboardData[PS_MSG_COUNT];
-
 #endif /* BLACKBOARDDATA_H_ */
@@ -0,0 +1,22 @@
+/*
+ * blackboardDebug.h
+ *
+ *      Author: martin
+ */
+
+#ifndef BLACKBOARDDEBUG_H_
+#define BLACKBOARDDEBUG_H_
+
+#include "SoftwareProfile.h"
+
+extern FILE *bbDebugFile;
+
+#ifdef BLACKBOARD_DEBUG
+#define DEBUGPRINT(...) fprintf(stdout, __VA_ARGS__);fprintf(bbDebugFile, __VA_ARGS__);fflush(bbDebugFile);
+#else
+#define DEBUGPRINT(...) fprintf(bbDebugFile, __VA_ARGS__);fflush(bbDebugFile);
+#endif
+
+#define ERRORPRINT(...) fprintf(stdout, __VA_ARGS__);fprintf(bbDebugFile, __VA_ARGS__);fflush(bbDebugFile);
+
+#endif
@@ -52,6 +52,7 @@ char currentline[MAXLINELENGTH];
 // our index into filling the line
 uint8_t lineidx = 0;
 int GPSfd;
+UartReader_t gpsReader;		//RX buffer
 
 uint8_t hour, minute, seconds, year, month, day;
 uint16_t milliseconds;
@@ -66,8 +67,6 @@ pthread_t GPSInit()
 	gpsDebugFile = fopen("/root/logfiles/gps.log", "w");
 
 	//open GPS uart
-	struct termios settings;
-
 	if (uart_setup(GPS_TX_PIN, GPS_RX_PIN) < 0)
 	{
 		ERRORPRINT("GPS uart_setup failed: %s\n");
@@ -86,23 +85,9 @@ pthread_t GPSInit()
 		DEBUGPRINT("GPS %s opened\n", GPS_UART_DEVICE);
 	}
 
-	if (tcgetattr(GPSfd, &settings) != 0) {
-		ERRORPRINT("GPS tcgetattr failed: %s\n", strerror(errno));
-		return -1;
-	}
-
-	//no processing
-	settings.c_iflag = 0;
-	settings.c_oflag = 0;
-	settings.c_lflag = 0;
-	settings.c_cflag = CLOCAL | CREAD | CS8;        //no modem, 8-bits
-
-	//baudrate
-	cfsetospeed(&settings, GPS_UART_BAUDRATE);
-	cfsetispeed(&settings, GPS_UART_BAUDRATE);
-
-	if (tcsetattr(GPSfd, TCSANOW, &settings) != 0) {
-		ERRORPRINT("GPS tcsetattr failed: %s\n", strerror(errno));
+	//NMEA sentences - a read() waits for most of one
+	if (uart_configure(GPSfd, GPS_UART_BAUDRATE, GPS_UART_VMIN, GPS_UART_VTIME) < 0) {
+		ERRORPRINT("GPS uart configure failed\n");
 		return -1;
 	}
 
@@ -134,6 +119,8 @@ void *GPSReaderThread(void *arg)
      SendCommand(PGCMD_ANTENNA);
      //need to spend time processing GPS data
 
+    uart_reader_init(&gpsReader, GPSfd);
+
     DEBUGPRINT("GPS thread ready\n");
 
 	while (1)
@@ -143,12 +130,9 @@ void *GPSReaderThread(void *arg)
         lineidx = 0;
         //read a message
         while (!parseResult) {
-            char c;
-            int chars_read;
-            do
-            {
-            	chars_read = read(GPSfd, &c, 1);
-            } while (chars_read == 0);
+            int next = uart_getc(&gpsReader);
+            if (next < 0) continue;
+            char c = (char) next;
 
             if (c == '$') {
                 lineidx = 0;
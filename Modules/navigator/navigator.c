@@ -62,6 +62,18 @@ pthread_t NavigatorInit()
 	int i;
 	navDebugFile = fopen("/root/logfiles/navigator.log", "w");
 
+	//only the latest IMU report matters - odometry is incremental, so never coalesced
+	SetQueueCoalesce(&navigatorQueue, IMU_REPORT);
+	SetQueueCoalesce(&navigatorQueue, TICK_1S);
+	psRegisterQueueStats(&navigatorQueue, "navigator");
+
+	//raw navigation data, plus the tick for timeouts
+	psSubscribeQueue(GPS_REPORT, &navigatorQueue);
+	psSubscribeQueue(IMU_REPORT, &navigatorQueue);
+	psSubscribeQueue(ODOMETRY, &navigatorQueue);
+	psSubscribeQueue(GETAFIX, &navigatorQueue);
+	psSubscribeQueue(TICK_1S, &navigatorQueue);
+
 	//create navigator thread
 	pthread_t thread;
 	int s = pthread_create(&thread, NULL, NavigatorThread, NULL);
@@ -82,6 +94,10 @@ void NavigatorProcessMessage(psMessage_t *msg)
 void *NavigatorThread(void *arg)
 {
 	psMessage_t *msg;
+	psMessage_t *batch[BROKER_Q_BATCH];
+	int batchCount = 0;
+	int batchNext = 0;
+	int timer;
 
 	//Robot pose
 	float roll = 0;
@@ -99,9 +115,10 @@ void *NavigatorThread(void *arg)
 	time_t latestReportTime = 0;
 	time_t latestAppReportTime = 0;
 
-	time_t getFixEndTime = 0;
-	BrokerQueue_t getFixQueue = BROKER_Q_INITIALIZER;
-	BrokerQueue_t varianceQueue = BROKER_Q_INITIALIZER;
+	bool gettingFix = false;
+	psPositionPayload_t *fixSamples = NULL;	//samples for the GETAFIX average
+	int fixSampleCount = 0;
+	int fixSampleSize = 0;
 
 	float northingSum, eastingSum;
 	int sampleCount = 0;
@@ -110,8 +127,8 @@ void *NavigatorThread(void *arg)
 	psMessage_t poseMsg;
 	psPosePayload_t lastPoseMsg;
 
-	bool GPSGood;
-	bool IMUGood;
+	bool GPSGood = false;
+	bool IMUGood = false;
 	bool reportRequired;
 
 	//set up filters
@@ -204,13 +221,44 @@ void *NavigatorThread(void *arg)
 
 	while (1) {
 
-		msg = GetNextMessage(&navigatorQueue);
-
-		DEBUGPRINT("Navigator RX: %s\n", psLongMsgNames[msg->header.messageType]);
+		//take pending messages a batch at a time, or a timer
+		if (batchNext == batchCount)
+		{
+			batchCount = GetQueueEvents(&navigatorQueue, batch, BROKER_Q_BATCH, &timer);
+			batchNext = 0;
+		}
 
 		reportRequired = false;
 
-		switch (msg->header.messageType)
+		if (batchCount == 0)
+		{
+			//timer expired
+			msg = NULL;
+
+			switch (timer)
+			{
+			case NAV_GPS_TIMER:
+				DEBUGPRINT("GPS data stale\n");
+				latestGPSFixTime = 0;
+				GPSGood = false;
+				break;
+			case NAV_IMU_TIMER:
+				DEBUGPRINT("IMU data stale\n");
+				IMUGood = false;
+				break;
+			case NAV_GETAFIX_TIMER:
+				//averaged on the next fix
+				gettingFix = false;
+				break;
+			}
+		}
+		else
+		{
+			msg = batch[batchNext++];
+			DEBUGPRINT("Navigator RX: %s\n", psLongMsgNames[msg->header.messageType]);
+		}
+
+		if (msg) switch (msg->header.messageType)
 		{
 		case GPS_REPORT:
 		{
@@ -221,6 +269,7 @@ void *NavigatorThread(void *arg)
 				if (oldestGPSFixTime = 0) oldestGPSFixTime = time(NULL);
 				//save the fix
 				latestGPSFixTime = time(NULL);
+				SetQueueTimer(&navigatorQueue, NAV_GPS_TIMER, RAW_DATA_TIMEOUT);
 				GPS_report = msg->positionPayload;
 
 				//adjust datum to give a distance in cm .northing and.easting)
@@ -240,35 +289,50 @@ void *NavigatorThread(void *arg)
 						GET_LATITUDE, GET_LONGITUDE,
 						GET_NORTHING, GET_EASTING);
 
-				if (getFixEndTime > time(NULL))
+				if (gettingFix || fixSampleCount > 0)
 				{
 					//fix averaging
-					//save message
-					AppendQueueEntry(&getFixQueue, (BrokerQueueEntry_t *) msg);
+					//save the sample
+					if (fixSampleCount == fixSampleSize)
+					{
+						int size = (fixSampleSize ? fixSampleSize * 2 : NAV_FIX_SAMPLES);
+						psPositionPayload_t *samples = realloc(fixSamples, size * sizeof(psPositionPayload_t));
+						if (samples)
+						{
+							fixSamples = samples;
+							fixSampleSize = size;
+						}
+					}
+					if (fixSampleCount < fixSampleSize)
+					{
+						fixSamples[fixSampleCount++] = msg->positionPayload;
+					}
+					else
+					{
+						ERRORPRINT("GetFix: no memory for sample\n");
+					}
 				}
-				else if (!isQueueEmpty(&getFixQueue))
+				DoneWithMessage(msg);
+
+				if (!gettingFix && fixSampleCount > 0)
 				{
-					AppendQueueEntry(&getFixQueue, (BrokerQueueEntry_t *) msg);
 					northingSum = eastingSum = 0;
 					sampleCount = 0;
 					//get average
-					while (!isQueueEmpty(&getFixQueue))
+					for (int i=0; i<fixSampleCount; i++)
 					{
-						psMessage_t *fixmsg = GetNextMessage(&getFixQueue);		//only if not empty - no wait
 						//adjust datum to give a distance in cm .northing and.easting)
-						Ncm = LatitudeToNorthing(fixmsg->positionPayload.latitude);
-						Ecm = LongitudeToEasting(fixmsg->positionPayload.longitude);
+						Ncm = LatitudeToNorthing(fixSamples[i].latitude);
+						Ecm = LongitudeToEasting(fixSamples[i].longitude);
 
 						northingSum += Ncm;
 						eastingSum  += Ecm;
 						sampleCount++;
 
 						DEBUGPRINT("#%i GetFix: %fN, %fE (%f, %f)\n",
-								sampleCount,fixmsg->positionPayload.latitude,
-								fixmsg->positionPayload.longitude,
+								sampleCount,fixSamples[i].latitude,
+								fixSamples[i].longitude,
 								Ncm, Ecm);
-
-						AppendQueueEntry(&varianceQueue, (BrokerQueueEntry_t *) fixmsg);
 					}
 					float northing = northingSum / sampleCount;		//mean
 					float easting = eastingSum / sampleCount;
@@ -276,13 +340,12 @@ void *NavigatorThread(void *arg)
 					float eastingSumErrors 	= 0;
 					float HDOP				= 0;
 					//get variance
-					while (!isQueueEmpty(&varianceQueue))
+					for (int i=0; i<fixSampleCount; i++)
 					{
-						psMessage_t *fixmsg = GetNextMessage(&varianceQueue);		//only if not empty - no wait
 						//adjust datum to give a distance in cm .northing and.easting)
 
-						Ncm = LatitudeToNorthing(fixmsg->positionPayload.latitude);
-						Ecm = LongitudeToEasting(fixmsg->positionPayload.longitude);
+						Ncm = LatitudeToNorthing(fixSamples[i].latitude);
+						Ecm = LongitudeToEasting(fixSamples[i].longitude);
 
 						float errorN = northing - Ncm;
 						float errorE = easting - Ecm;
@@ -290,9 +353,7 @@ void *NavigatorThread(void *arg)
 						northingSumErrors = errorN * errorN;
 						eastingSumErrors = errorE * errorE;
 
-						HDOP   = fixmsg->positionPayload.HDOP;
-
-						DoneWithMessage(fixmsg);
+						HDOP   = fixSamples[i].HDOP;
 					}
 					float northingVariance = northingSumErrors / sampleCount;
 					float eastingVariance = eastingSumErrors / sampleCount;
@@ -308,10 +369,8 @@ void *NavigatorThread(void *arg)
 					DEBUGPRINT("GetFix: %f, %f. Var %f, %f\n", GET_NORTHING, GET_EASTING, northingVariance, eastingVariance);
 
 					GPSGood = (sampleCount > 10 && HDOP <= 10 ? true : false);
-				}
-				else
-				{
-					DoneWithMessage(msg);
+
+					fixSampleCount = 0;
 				}
 			}
 			else
@@ -325,6 +384,7 @@ void *NavigatorThread(void *arg)
 		case IMU_REPORT:
 		{
 			latestIMUReportTime = time(NULL);
+			SetQueueTimer(&navigatorQueue, NAV_IMU_TIMER, RAW_DATA_TIMEOUT);
 			IMU_report = msg->threeFloatPayload;
 			IMUGood = true;
 			//update heading belief
@@ -372,7 +432,8 @@ void *NavigatorThread(void *arg)
 		break;
 		case GETAFIX:
 			//set up averaging data
-			getFixEndTime = time(NULL) + msg->intPayload.value;
+			gettingFix = true;
+			SetQueueTimer(&navigatorQueue, NAV_GETAFIX_TIMER, msg->intPayload.value * 1000);
 			DEBUGPRINT("Starting GetAFix %i\n", msg->intPayload.value);
 			DoneWithMessage(msg);
 			break;
@@ -382,16 +443,6 @@ void *NavigatorThread(void *arg)
 		}
 
 
-		if (time(NULL) - latestGPSFixTime > RAW_DATA_TIMEOUT)
-		{
-			latestGPSFixTime = 0;
-			GPSGood = false;
-		}
-		if (time(NULL) - latestIMUReportTime > RAW_DATA_TIMEOUT)
-		{
-			IMUGood = false;
-		}
-
 		int savedState = navigationState;
 
 		switch (navigationState)
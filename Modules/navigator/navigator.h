@@ -26,9 +26,15 @@ int timeval_subtract (struct timeval *result, struct timeval *x, struct timeval
 #define REPORT_MIN_CONFIDENCE		0.5f
 #define REPORT_LOCATION_CHANGE 		5
 
-#define RAW_DATA_TIMEOUT 		5	//seconds
+#define RAW_DATA_TIMEOUT 		5000	//mS
 #define GPS_STABILITY_TIME 		30	//seconds
 #define GPS_FIX_LOST_TIMEOUT	5	//seconds
+#define NAV_FIX_SAMPLES			64	//initial GETAFIX sample space - doubled as needed
+
+//navigator queue timers
+#define NAV_GPS_TIMER			0	//GPS fix stale
+#define NAV_IMU_TIMER			1	//IMU report stale
+#define NAV_GETAFIX_TIMER		2	//end of fix averaging
 
 //start navigator task
 pthread_t NavigatorInit();
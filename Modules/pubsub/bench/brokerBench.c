@@ -0,0 +1,621 @@
+/*
+ ============================================================================
+ Name        : brokerBench.c
+ Author      : Martin
+ Description : Host benchmark for the pubsub core. Drives synthetic traffic
+ through the broker dispatchers into stub modules and reports throughput,
+ publish-to-dequeue latency and pool growth.
+ ============================================================================
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "PubSubData.h"
+#include "pubsub/pubsub.h"
+#include "brokerQ.h"
+#include "shmBroker.h"
+
+extern FILE *psDebugFile;
+
+//latency histogram - log2 buckets split 16 ways, values in nS
+#define HIST_SUB_BITS	4
+#define HIST_BUCKETS	(64 << HIST_SUB_BITS)
+
+typedef struct {
+	uint64_t count;
+	uint64_t bucket[HIST_BUCKETS];
+} BenchHistogram_t;
+
+//stub modules - each drains its own queue on its own thread
+enum {
+	BENCH_NAVIGATOR,
+	BENCH_AUTOPILOT,
+	BENCH_LOG,
+	BENCH_BLACKBOARD,
+	BENCH_BEHAVIOR,
+	BENCH_RESPONDER,
+	BENCH_MODULE_COUNT
+};
+
+typedef struct {
+	char *name;
+	BrokerQueue_t queue;
+	BenchHistogram_t latency;		//every message
+	BenchHistogram_t urgent;		//lane 0 messages only
+	uint64_t delivered;
+} BenchModule_t;
+
+BenchModule_t modules[BENCH_MODULE_COUNT];
+
+//traffic mixes - relative weights per message type
+typedef struct {
+	char *name;
+	int weight[PS_MSG_COUNT];
+} BenchMix_t;
+
+BenchMix_t mixes[] = {
+		{"odometry", {[ODOMETRY] = 80, [IMU_REPORT] = 10, [POSE] = 8, [NOTIFICATION] = 1, [TICK_1S] = 1}},
+		{"logflood", {[SYSLOG_MSG] = 60, [BBBLOG_MSG] = 30, [ODOMETRY] = 8, [NOTIFICATION] = 2}},
+		{"tick", {[TICK_1S] = 90, [NOTIFICATION] = 10}},
+};
+#define MIX_COUNT	(sizeof(mixes) / sizeof(BenchMix_t))
+
+//run parameters
+int producerCount = 2;
+int messagesPerProducer = 100000;
+int producerRate = 0;				//per producer, msgs/sec - 0 = flat out
+int queueDepth = 64;				//BROKER_Q_BLOCK depth on every queue
+bool printStats = false;			//broker stats report after the runs
+int dispatchers = 1;				//broker routing threads
+bool pinDispatchers = false;		//dispatcher n on CPU n
+bool shmExport = false;				//also write everything to the shm ring
+bool tapEnabled = false;			//attach a filtered tap for each run
+bool laneCheck = false;				//only check that appends below the depth limit are never refused
+
+int fanout[PS_MSG_COUNT];			//deliveries per published message
+uint64_t expected;					//deliveries owed for what has been published
+uint64_t refused;					//publishes the broker queue refused
+
+typedef struct {
+	BenchMix_t *mix;
+	int id;
+	pthread_t thread;
+} BenchProducer_t;
+
+uint64_t BenchNow()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline int HistogramBucket(uint64_t v)
+{
+	if (v < (1 << HIST_SUB_BITS)) return (int) v;
+
+	int shift = (63 - __builtin_clzll(v)) - HIST_SUB_BITS;
+	return ((shift + 1) << HIST_SUB_BITS) + (int)((v >> shift) & ((1 << HIST_SUB_BITS) - 1));
+}
+
+//lowest value in a bucket
+uint64_t HistogramValue(int b)
+{
+	if (b < (1 << HIST_SUB_BITS)) return b;
+
+	int shift = (b >> HIST_SUB_BITS) - 1;
+	uint64_t mantissa = (b & ((1 << HIST_SUB_BITS) - 1)) | (1 << HIST_SUB_BITS);
+	return mantissa << shift;
+}
+
+void HistogramAdd(BenchHistogram_t *total, BenchHistogram_t *h)
+{
+	int b;
+	for (b=0; b<HIST_BUCKETS; b++) total->bucket[b] += h->bucket[b];
+	total->count += h->count;
+}
+
+//percentile in uS
+double HistogramPercentile(BenchHistogram_t *h, double p)
+{
+	uint64_t target = (uint64_t)(h->count * p);
+	uint64_t seen = 0;
+	int b;
+
+	if (h->count == 0) return 0.0;
+
+	for (b=0; b<HIST_BUCKETS; b++)
+	{
+		seen += h->bucket[b];
+		if (seen > target) break;
+	}
+	return HistogramValue(b) / 1000.0;
+}
+
+//stub module thread - takes batches and records latency
+void *ModuleThread(void *arg)
+{
+	BenchModule_t *m = (BenchModule_t *) arg;
+	psMessage_t *batch[BROKER_Q_BATCH];
+	int n, i;
+
+	while (1)
+	{
+		n = GetNextMessages(&m->queue, batch, BROKER_Q_BATCH, -1);
+
+		uint64_t now = BenchNow();
+		for (i=0; i<n; i++)
+		{
+			uint64_t latency = now - batch[i]->benchPayload.sent;
+			int b = HistogramBucket(latency);
+
+			m->latency.bucket[b]++;
+			m->latency.count++;
+			if (psQOS[batch[i]->header.messageType] == PS_QOS1)
+			{
+				m->urgent.bucket[b]++;
+				m->urgent.count++;
+			}
+		}
+		DoneWithMessages(batch, n);
+
+		//published after the histograms, so a quiescent count means the histograms are complete
+		__atomic_add_fetch(&m->delivered, n, __ATOMIC_RELEASE);
+	}
+	return 0;
+}
+
+//copying handlers - as the modules that use psSubscribe
+void AutopilotStub(psMessage_t *msg)
+{
+	CopyMessageToQ(&modules[BENCH_AUTOPILOT].queue, msg);
+}
+void LogStub(psMessage_t *msg)
+{
+	CopyMessageToQ(&modules[BENCH_LOG].queue, msg);
+}
+
+void *ProducerThread(void *arg)
+{
+	BenchProducer_t *p = (BenchProducer_t *) arg;
+	psMessage_t msg;
+	struct timespec next;
+	int cumulative[PS_MSG_COUNT];
+	int total = 0;
+	int i, t;
+	uint32_t rng = 0x9e3779b9 * (p->id + 1);
+
+	for (t=0; t<PS_MSG_COUNT; t++)
+	{
+		total += p->mix->weight[t];
+		cumulative[t] = total;
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	msg.header.source = OVERMIND;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+
+	for (i=0; i<messagesPerProducer; i++)
+	{
+		//xorshift pick from the mix
+		rng ^= rng << 13;
+		rng ^= rng >> 17;
+		rng ^= rng << 5;
+		int pick = rng % total;
+		for (t=0; cumulative[t] <= pick; t++);
+
+		msg.header.messageType = t;
+		msg.benchPayload.seq = i;
+		msg.benchPayload.sent = BenchNow();
+
+		if (NewBrokerMessage(&msg) == 0)
+		{
+			__atomic_add_fetch(&expected, fanout[t], __ATOMIC_RELAXED);
+		}
+		else
+		{
+			__atomic_add_fetch(&refused, 1, __ATOMIC_RELAXED);
+		}
+
+		if (producerRate > 0)
+		{
+			next.tv_nsec += 1000000000 / producerRate;
+			if (next.tv_nsec >= 1000000000)
+			{
+				next.tv_sec++;
+				next.tv_nsec -= 1000000000;
+			}
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+		}
+	}
+	return 0;
+}
+
+//diagnostic tap - every 16th raw nav message from OVERMIND
+uint64_t tapped;
+
+bool TapPredicate(psMessage_t *msg, void *arg)
+{
+	return (msg->benchPayload.seq % 16) == 0;
+}
+
+void TapHandler(psMessage_t *msg)
+{
+	__atomic_add_fetch(&tapped, 1, __ATOMIC_RELAXED);
+}
+
+uint64_t Delivered()
+{
+	uint64_t d = 0;
+	int i;
+	for (i=0; i<BENCH_MODULE_COUNT; i++) d += __atomic_load_n(&modules[i].delivered, __ATOMIC_ACQUIRE);
+	return d;
+}
+
+//run one mix and print a result line
+void RunMix(BenchMix_t *mix)
+{
+	BenchProducer_t producers[producerCount];
+	BenchHistogram_t *latency = calloc(1, sizeof(BenchHistogram_t));
+	BenchHistogram_t *urgent = calloc(1, sizeof(BenchHistogram_t));
+	BrokerPoolStats_t before, after;
+	psFilter_t filter;
+	int tap = -1;
+	int i;
+
+	//quiescent - safe to reset from here
+	for (i=0; i<BENCH_MODULE_COUNT; i++)
+	{
+		memset(&modules[i].latency, 0, sizeof(BenchHistogram_t));
+		memset(&modules[i].urgent, 0, sizeof(BenchHistogram_t));
+		modules[i].delivered = 0;
+	}
+	expected = 0;
+	refused = 0;
+	tapped = 0;
+	BrokerPoolStats(&before);
+
+	if (tapEnabled)
+	{
+		psFilterInit(&filter);
+		psFilterTopic(&filter, RAW_NAV_TOPIC);
+		filter.source = OVERMIND;
+		filter.predicate = TapPredicate;
+		tap = psAddTap(&filter, NULL, TapHandler);
+	}
+
+	uint64_t start = BenchNow();
+
+	for (i=0; i<producerCount; i++)
+	{
+		producers[i].mix = mix;
+		producers[i].id = i;
+		pthread_create(&producers[i].thread, NULL, ProducerThread, &producers[i]);
+	}
+	for (i=0; i<producerCount; i++)
+	{
+		pthread_join(producers[i].thread, NULL);
+	}
+
+	//wait for the tail to drain, give up if it stalls
+	uint64_t last = 0, lastChange = BenchNow();
+	uint64_t d;
+	while ((d = Delivered()) < __atomic_load_n(&expected, __ATOMIC_RELAXED))
+	{
+		if (d != last)
+		{
+			last = d;
+			lastChange = BenchNow();
+		}
+		else if (BenchNow() - lastChange > 2000000000ULL)
+		{
+			fprintf(stderr, "%s: stalled at %llu of %llu deliveries\n", mix->name,
+					(unsigned long long) d, (unsigned long long) expected);
+			break;
+		}
+		usleep(100);
+	}
+
+	double elapsed = (BenchNow() - start) / 1e9;
+	BrokerPoolStats(&after);
+
+	if (tap >= 0) psRemoveTap(tap);
+
+	for (i=0; i<BENCH_MODULE_COUNT; i++)
+	{
+		HistogramAdd(latency, &modules[i].latency);
+		HistogramAdd(urgent, &modules[i].urgent);
+	}
+
+	uint64_t published = (uint64_t) producerCount * messagesPerProducer - refused;
+
+	printf("%-10s %9.0f %11.0f %9.2f %9.2f %9.2f %9.2f %9llu %6u %9u %9u\n",
+			mix->name,
+			published / elapsed,
+			d / elapsed,
+			HistogramPercentile(latency, 0.5),
+			HistogramPercentile(latency, 0.99),
+			HistogramPercentile(latency, 0.999),
+			HistogramPercentile(urgent, 0.99),
+			(unsigned long long) refused,
+			after.slabs - before.slabs,
+			after.allocated,
+			after.inUseHWM);
+
+	if (tap >= 0)
+	{
+		printf("%-10s tap matched %llu\n", "", (unsigned long long) tapped);
+	}
+
+	free(latency);
+	free(urgent);
+}
+
+//lane check - producers append straight into one lane while a consumer drains it
+//appends are admitted only while fewer than the depth limit are in flight, so none may be refused
+BrokerQueue_t laneQueue = BROKER_Q_INITIALIZER;
+uint32_t laneInFlight;
+uint64_t laneRefused;
+uint64_t laneTaken;
+
+void *LaneProducerThread(void *arg)
+{
+	psMessage_t msg;
+	int i;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.header.messageType = ODOMETRY;
+
+	for (i=0; i<messagesPerProducer; i++)
+	{
+		//reserve a place below the limit
+		while (__atomic_add_fetch(&laneInFlight, 1, __ATOMIC_ACQ_REL) > (uint32_t) queueDepth)
+		{
+			__atomic_sub_fetch(&laneInFlight, 1, __ATOMIC_ACQ_REL);
+			sched_yield();
+		}
+		msg.benchPayload.seq = i;
+		if (CopyMessageToQ(&laneQueue, &msg) < 0)
+		{
+			__atomic_add_fetch(&laneRefused, 1, __ATOMIC_RELAXED);
+			__atomic_sub_fetch(&laneInFlight, 1, __ATOMIC_ACQ_REL);
+		}
+	}
+	return 0;
+}
+
+void *LaneConsumerThread(void *arg)
+{
+	psMessage_t *batch[BROKER_Q_BATCH];
+	int n;
+
+	while (1)
+	{
+		n = GetNextMessages(&laneQueue, batch, BROKER_Q_BATCH, -1);
+		DoneWithMessages(batch, n);
+		__atomic_add_fetch(&laneTaken, n, __ATOMIC_RELAXED);
+		__atomic_sub_fetch(&laneInFlight, n, __ATOMIC_ACQ_REL);
+	}
+	return 0;
+}
+
+//returns the number refused below the limit - 0 expected
+uint64_t LaneCheck()
+{
+	pthread_t producers[producerCount];
+	pthread_t consumer;
+	int i;
+
+	SetQueuePolicy(&laneQueue, queueDepth, BROKER_Q_DROP_NEWEST);
+	pthread_create(&consumer, NULL, LaneConsumerThread, NULL);
+
+	uint64_t start = BenchNow();
+	for (i=0; i<producerCount; i++)
+	{
+		pthread_create(&producers[i], NULL, LaneProducerThread, NULL);
+	}
+	for (i=0; i<producerCount; i++)
+	{
+		pthread_join(producers[i], NULL);
+	}
+	uint64_t total = (uint64_t) producerCount * messagesPerProducer;
+	while (__atomic_load_n(&laneTaken, __ATOMIC_RELAXED) + __atomic_load_n(&laneRefused, __ATOMIC_RELAXED) < total)
+	{
+		usleep(100);
+	}
+	double elapsed = (BenchNow() - start) / 1e9;
+
+	printf("lane check: %i producers x %i msgs, depth %i, %.0f msgs/s, %llu refused below the limit\n",
+			producerCount, messagesPerProducer, queueDepth, total / elapsed,
+			(unsigned long long) laneRefused);
+	return laneRefused;
+}
+
+//DROP_OLDEST trims telemetry but never the urgent lane - returns the number wrong
+int UrgentLaneCheck()
+{
+	BrokerQueue_t q = BROKER_Q_INITIALIZER;
+	psMessage_t msg, *batch[BROKER_Q_CAPACITY];
+	int urgentRefused = 0, routineRefused = 0;
+	int i, n, wrong = 0;
+	int depth = 4;
+
+	SetQueuePolicy(&q, depth, BROKER_Q_DROP_OLDEST);
+	memset(&msg, 0, sizeof(msg));
+
+	for (i=0; i<2 * depth; i++)
+	{
+		msg.benchPayload.seq = i;
+		msg.header.messageType = NOTIFICATION;		//PS_QOS1 - lane 0
+		if (CopyMessageToQ(&q, &msg) < 0) urgentRefused++;
+		msg.header.messageType = ODOMETRY;
+		if (CopyMessageToQ(&q, &msg) < 0) routineRefused++;
+	}
+
+	//the first urgent messages and the newest telemetry
+	n = GetNextMessages(&q, batch, BROKER_Q_CAPACITY, 0);
+	int urgent = 0, routine = 0;
+	for (i=0; i<n; i++)
+	{
+		if (batch[i]->header.messageType == NOTIFICATION)
+		{
+			if (batch[i]->benchPayload.seq != urgent++) wrong++;
+		}
+		else if (batch[i]->benchPayload.seq != depth + routine++) wrong++;
+	}
+	DoneWithMessages(batch, n);
+	if (urgent != depth || urgentRefused != depth || routine != depth || routineRefused != 0) wrong++;
+
+	printf("urgent lane: %i kept, %i refused. telemetry: %i kept newest, %i refused. %i wrong\n",
+			urgent, urgentRefused, routine, routineRefused, wrong);
+	return wrong;
+}
+
+void Usage(char *name)
+{
+	fprintf(stderr, "usage: %s [-m odometry|logflood|tick|all] [-p producers] [-n msgs per producer] [-r msgs/sec per producer] [-d queue depth] [-w dispatchers] [-c] [-x] [-f] [-s] [-l]\n", name);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	char *mixName = "all";
+	pthread_t thread;
+	int opt, i, t;
+
+	while ((opt = getopt(argc, argv, "m:p:n:r:d:w:cxfsl")) != -1)
+	{
+		switch (opt)
+		{
+		case 'm':
+			mixName = optarg;
+			break;
+		case 'p':
+			producerCount = atoi(optarg);
+			break;
+		case 'n':
+			messagesPerProducer = atoi(optarg);
+			break;
+		case 'r':
+			producerRate = atoi(optarg);
+			break;
+		case 'd':
+			queueDepth = atoi(optarg);
+			break;
+		case 'w':
+			dispatchers = atoi(optarg);
+			break;
+		case 'c':
+			pinDispatchers = true;
+			break;
+		case 'x':
+			shmExport = true;
+			break;
+		case 'f':
+			tapEnabled = true;
+			break;
+		case 's':
+			printStats = true;
+			break;
+		case 'l':
+			laneCheck = true;
+			break;
+		default:
+			Usage(argv[0]);
+			break;
+		}
+	}
+	if (producerCount < 1 || messagesPerProducer < 1) Usage(argv[0]);
+
+	psDebugFile = fopen("/dev/null", "w");
+
+	BrokerQueueInit(BROKER_POOL_PRELOAD);
+
+	if (laneCheck) return (LaneCheck() == 0 && UrgentLaneCheck() == 0 ? 0 : 1);
+
+	//lossless - producers wait rather than drop, so every delivery is counted
+	psSetDispatchPolicy(queueDepth, BROKER_Q_BLOCK);
+
+	int cpus[PS_MAX_DISPATCHERS];
+	int nprocs = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	for (i=0; i<PS_MAX_DISPATCHERS; i++) cpus[i] = (pinDispatchers ? i % nprocs : -1);
+	if (psSetDispatchers(dispatchers, cpus) < 0) Usage(argv[0]);
+
+	modules[BENCH_NAVIGATOR].name = "navigator";
+	modules[BENCH_AUTOPILOT].name = "autopilot";
+	modules[BENCH_LOG].name = "log";
+	modules[BENCH_BLACKBOARD].name = "blackboard";
+	modules[BENCH_BEHAVIOR].name = "behavior";
+	modules[BENCH_RESPONDER].name = "responder";
+
+	for (i=0; i<BENCH_MODULE_COUNT; i++)
+	{
+		SetQueuePolicy(&modules[i].queue, queueDepth, BROKER_Q_BLOCK);
+		psRegisterQueueStats(&modules[i].queue, modules[i].name);
+		pthread_create(&thread, NULL, ModuleThread, &modules[i]);
+	}
+
+	//subscriptions modelled on the real modules
+	psSubscribeQueue(ODOMETRY, &modules[BENCH_NAVIGATOR].queue);
+	psSubscribeQueue(IMU_REPORT, &modules[BENCH_NAVIGATOR].queue);
+	psSubscribeQueue(TICK_1S, &modules[BENCH_NAVIGATOR].queue);
+
+	psSubscribe(ODOMETRY, AutopilotStub);
+	psSubscribe(POSE, AutopilotStub);
+	psSubscribe(NOTIFICATION, AutopilotStub);
+	psSubscribe(TICK_1S, AutopilotStub);
+
+	psSubscribe(SYSLOG_MSG, LogStub);
+	psSubscribe(BBBLOG_MSG, LogStub);
+
+	psSubscribeQueue(TICK_1S, &modules[BENCH_BLACKBOARD].queue);
+	psSubscribeQueue(NOTIFICATION, &modules[BENCH_BLACKBOARD].queue);
+
+	psSubscribeQueue(TICK_1S, &modules[BENCH_BEHAVIOR].queue);
+	psSubscribeQueue(NOTIFICATION, &modules[BENCH_BEHAVIOR].queue);
+
+	psSubscribeQueue(TICK_1S, &modules[BENCH_RESPONDER].queue);
+
+	fanout[ODOMETRY] = 2;
+	fanout[IMU_REPORT] = 1;
+	fanout[POSE] = 1;
+	fanout[NOTIFICATION] = 3;
+	fanout[TICK_1S] = 5;
+	fanout[SYSLOG_MSG] = 1;
+	fanout[BBBLOG_MSG] = 1;
+
+	BrokerDispatchInit();
+
+	//read it with shmTap from another shell
+	if (shmExport && ShmBrokerInit() < 0) return 1;
+
+	printf("%i producers x %i msgs, rate %i/s per producer, queue depth %i, %i dispatchers%s\n",
+			producerCount, messagesPerProducer, producerRate, queueDepth, dispatchers,
+			(pinDispatchers ? " pinned" : ""));
+	printf("%-10s %9s %11s %9s %9s %9s %9s %9s %6s %9s %9s\n",
+			"mix", "routed/s", "delivered/s", "p50 uS", "p99 uS", "p999 uS", "urg p99", "refused", "slabs+", "allocated", "inUseHWM");
+
+	for (t=0; t<MIX_COUNT; t++)
+	{
+		if (strcmp(mixName, "all") == 0 || strcmp(mixName, mixes[t].name) == 0)
+		{
+			RunMix(&mixes[t]);
+		}
+	}
+
+	if (printStats)
+	{
+		printf("\n");
+		PrintBrokerStats(stdout);
+	}
+	return 0;
+}
@@ -0,0 +1,183 @@
+/*
+ ============================================================================
+ Name        : codecBench.c
+ Author      : Martin
+ Description : Round trip of the serial link's compact payload codec. Encodes
+ synthetic telemetry streams, loses a share of the frames on the way, decodes
+ the rest and checks each against what was sent. Reports payload bytes on the
+ wire against the raw payloads. First checks that only the enabled type is
+ coded, not others sharing its format.
+ ============================================================================
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "PubSubData.h"
+#include "wireCodec.h"
+
+//run parameters
+long frames = 100000;
+int lossPercent = 0;
+unsigned seed = 1;
+
+psWireCodec_t tx, rx;
+
+typedef void (*Generator_t)(psMessage_t *msg, long i);
+
+//odometry style - small counts, a sequence number and a 20mS timestamp
+void Counts(psMessage_t *msg, long i)
+{
+	static int32_t value;
+
+	value += (rand() % 7) - 3;
+	msg->benchPayload.value = value;
+	msg->benchPayload.seq = (uint32_t) i;
+	msg->benchPayload.sent = 1000000000ULL + (uint64_t) i * 20000000ULL + (rand() % 1000);
+}
+
+//pose style - four slowly moving floats
+void Floats(psMessage_t *msg, long i)
+{
+	static float f[4] = {100.0f, -20.0f, 1.5f, 0.25f};
+	int k;
+
+	for (k=0; k<4; k++)
+	{
+		if (rand() % 4 == 0) f[k] += ((rand() % 201) - 100) * 0.001f;
+	}
+	memcpy(msg->packet, f, sizeof(f));
+}
+
+//noise - every word changes, deltas should lose to plain frames
+void Noise(psMessage_t *msg, long i)
+{
+	int k;
+	for (k=0; k<msg->header.length; k++) msg->packet[k] = (uint8_t) rand();
+}
+
+void Run(char *name, Generator_t generator)
+{
+	psMessage_t sent, frame;
+	long i, decoded = 0, lost = 0, mismatches = 0;
+	int k;
+
+	psWireCodecInit(&tx);
+	psWireCodecInit(&rx);
+	srand(seed);
+
+	memset(&sent, 0, sizeof(sent));
+	sent.header.messageType = ODOMETRY;
+	sent.header.source = APP_XBEE;
+	sent.header.length = psMessageFormatLengths[psMsgFormats[ODOMETRY]];
+
+	for (i=0; i<frames; i++)
+	{
+		generator(&sent, i);
+
+		//as TxThread frames it
+		frame.header = sent.header;
+		int length = psWireEncode(&tx, &sent, frame.packet);
+		if (length > 0)
+		{
+			frame.header.length = length;
+			frame.header.messageType |= PS_WIRE_COMPACT;
+		}
+		else
+		{
+			memcpy(frame.packet, sent.packet, sent.header.length);
+		}
+
+		if (lossPercent && rand() % 100 < lossPercent)
+		{
+			lost++;
+			continue;
+		}
+
+		//as RxThread takes it
+		if (psWireDecode(&rx, &frame) < 0) continue;
+		decoded++;
+
+		if (frame.header.messageType != sent.header.messageType || frame.header.length != sent.header.length
+				|| memcmp(frame.packet, sent.packet, sent.header.length) != 0)
+		{
+			if (mismatches++ < 5)
+			{
+				fprintf(stderr, "%s: frame %li decoded wrong:", name, i);
+				for (k=0; k<sent.header.length; k++) fprintf(stderr, " %02x/%02x", sent.packet[k], frame.packet[k]);
+				fprintf(stderr, "\n");
+			}
+		}
+	}
+
+	printf("%-8s %8li %8li %8li %8u %8u %8u %6.1f%% %8li\n",
+			name, frames, lost, decoded, tx.keyframes, tx.deltas, rx.resyncs,
+			100.0 * tx.wireBytes / tx.rawBytes, mismatches);
+}
+
+void Usage(char *name)
+{
+	fprintf(stderr, "usage: %s [-n frames] [-l loss %%] [-s seed]\n", name);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:l:s:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n':
+			frames = atol(optarg);
+			break;
+		case 'l':
+			lossPercent = atoi(optarg);
+			break;
+		case 's':
+			seed = (unsigned) atoi(optarg);
+			break;
+		default:
+			Usage(argv[0]);
+			break;
+		}
+	}
+	if (frames < 1 || lossPercent < 0 || lossPercent > 100) Usage(argv[0]);
+
+	if (psWireCompact(ODOMETRY) < 0)
+	{
+		fprintf(stderr, "ODOMETRY format is not fixed size\n");
+		return 1;
+	}
+
+	//enabled by type - TICK_1S shares the format but is not coded, NOTIFICATION is urgent
+	psMessage_t tick;
+	uint8_t packet[PS_MAX_PAYLOAD];
+	memset(&tick, 0, sizeof(tick));
+	tick.header.messageType = TICK_1S;
+	tick.header.length = psMessageFormatLengths[psMsgFormats[TICK_1S]];
+	psWireEncode(&tx, &tick, packet);
+	if (psWireEncode(&tx, &tick, packet) != 0 || tx.rawBytes != 0 || psWireCompact(NOTIFICATION) == 0)
+	{
+		fprintf(stderr, "codec applied beyond the enabled type\n");
+		return 1;
+	}
+
+	printf("%li frames of %i bytes, %i%% lost, keyframe every %i\n",
+			frames, psMessageFormatLengths[psMsgFormats[ODOMETRY]], lossPercent, PS_WIRE_KEYFRAME);
+	printf("%-8s %8s %8s %8s %8s %8s %8s %7s %8s\n",
+			"stream", "frames", "lost", "decoded", "keys", "deltas", "resyncs", "wire", "wrong");
+
+	Run("counts", Counts);
+	Run("floats", Floats);
+	Run("noise", Noise);
+
+	return 0;
+}
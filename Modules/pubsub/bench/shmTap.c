@@ -0,0 +1,92 @@
+/*
+ ============================================================================
+ Name        : shmTap.c
+ Author      : Martin
+ Description : Reads the shared-memory pubsub ring from another process.
+ Prints each message, or with -q just the per-second received and lost
+ counts. Run alongside fido.elf, or brokerBench -x on a host.
+ ============================================================================
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "PubSubData.h"
+#include "shmBroker.h"
+
+void Usage(char *name)
+{
+	fprintf(stderr, "usage: %s [-t topic number]... [-n messages] [-q]\n", name);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	psShmReader_t reader;
+	psMessage_t msg;
+	uint32_t topics = PS_SHM_ALL_TOPICS;
+	long limit = 0;					//0 = run until killed
+	bool quiet = false;
+	int opt, t;
+
+	while ((opt = getopt(argc, argv, "t:n:q")) != -1)
+	{
+		switch (opt)
+		{
+		case 't':
+			t = atoi(optarg);
+			if (t < 0 || t >= PS_TOPIC_COUNT) Usage(argv[0]);
+			topics |= PS_SHM_TOPIC(t);
+			break;
+		case 'n':
+			limit = atol(optarg);
+			break;
+		case 'q':
+			quiet = true;
+			break;
+		default:
+			Usage(argv[0]);
+			break;
+		}
+	}
+
+	if (psShmOpen(&reader, topics) < 0) return 1;
+
+	fprintf(stderr, "attached to %s, writer pid %i, position %u\n",
+			PS_SHM_NAME, reader.ring->writerPid, reader.next);
+
+	time_t lastReport = time(NULL);
+	uint32_t lastReceived = 0, lastLost = 0;
+
+	while (limit == 0 || reader.received < limit)
+	{
+		if (psShmNext(&reader, &msg, 1000) && !quiet)
+		{
+			unsigned type = msg.header.messageType;
+			printf("%-20s from %-10s len %i\n",
+					(type < PS_MSG_COUNT ? psLongMsgNames[type] : "(unknown)"),
+					(msg.header.source < SUBSYSTEM_COUNT ? subsystemNames[msg.header.source] : "?"),
+					msg.header.length);
+		}
+
+		time_t now = time(NULL);
+		if (quiet && now != lastReport)
+		{
+			printf("%u received/s, %u lost/s\n", reader.received - lastReceived, reader.lost - lastLost);
+			fflush(stdout);
+			lastReport = now;
+			lastReceived = reader.received;
+			lastLost = reader.lost;
+		}
+	}
+
+	fprintf(stderr, "%u received, %u lost\n", reader.received, reader.lost);
+	psShmClose(&reader);
+	return 0;
+}
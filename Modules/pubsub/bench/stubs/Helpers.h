@@ -0,0 +1,16 @@
+/*
+ * Helpers.h
+ *
+ * Host stand-in - message helpers used by the broker core
+ *
+ *      Author: martin
+ */
+
+#ifndef HELPERS_H_
+#define HELPERS_H_
+
+#include "PubSubData.h"
+
+void AdjustMessageLength(psMessage_t *msg);
+
+#endif /* HELPERS_H_ */
@@ -0,0 +1,9 @@
+//messagemacro(enum, qos, topic, format, long name)
+messagemacro(SYSLOG_MSG, PS_QOS3, LOG_TOPIC, PS_LOG_FORMAT, "SysLog")
+messagemacro(BBBLOG_MSG, PS_QOS3, LOG_TOPIC, PS_LOG_FORMAT, "BBB Log")
+messagemacro(NOTIFICATION, PS_QOS1, ANNOUNCEMENTS_TOPIC, PS_INT_FORMAT, "Notify")
+messagemacro(TICK_1S, PS_QOS2, ANNOUNCEMENTS_TOPIC, PS_BENCH_FORMAT, "Tick")
+messagemacro(ODOMETRY, PS_QOS2, RAW_NAV_TOPIC, PS_BENCH_FORMAT, "Odometry")
+messagemacro(IMU_REPORT, PS_QOS2, RAW_NAV_TOPIC, PS_BENCH_FORMAT, "IMU")
+messagemacro(POSE, PS_QOS2, NAV_REPORT_TOPIC, PS_BENCH_FORMAT, "Pose")
+messagemacro(GEN_STATS, PS_QOS3, STATS_TOPIC, PS_NAME_INT_FORMAT, "Stats")
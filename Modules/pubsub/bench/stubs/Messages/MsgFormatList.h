@@ -0,0 +1,6 @@
+//formatmacro(enum, type, var, size)
+formatmacro(PS_UNKNOWN_FORMAT, void, none, 0)
+formatmacro(PS_INT_FORMAT, psIntPayload_t, intPayload, sizeof(psIntPayload_t))
+formatmacro(PS_NAME_INT_FORMAT, psNameIntPayload_t, nameIntPayload, sizeof(psNameIntPayload_t))
+formatmacro(PS_BENCH_FORMAT, psBenchPayload_t, benchPayload, sizeof(psBenchPayload_t))
+formatmacro(PS_LOG_FORMAT, uint8_t, packet, PS_MAX_PAYLOAD)
@@ -0,0 +1,90 @@
+/*
+ * PubSubData.h
+ *
+ * Host stand-in for the generated PubSubData.h - just enough of the message set
+ * to build the broker core for the benchmark. Messages are in Messages/MessageList.h
+ *
+ *      Author: martin
+ */
+
+#ifndef PUBSUBDATA_H_
+#define PUBSUBDATA_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef enum {OVERMIND, APP_XBEE, SUBSYSTEM_COUNT} Subsystem_enum;
+#define SUBSYSTEM_NAMES {"Overmind", "App"}
+
+typedef enum {LOG_TOPIC, ANNOUNCEMENTS_TOPIC, RAW_NAV_TOPIC, NAV_REPORT_TOPIC, STATS_TOPIC, PS_TOPIC_COUNT} psTopic_enum;
+#define PS_TOPIC_NAMES {"Log", "Announcements", "Raw Nav", "Nav Report", "Stats"}
+
+//first value most urgent - broker lane 0
+typedef enum {PS_QOS1, PS_QOS2, PS_QOS3} psQOS_enum;
+
+typedef enum {SYSLOG_ROUTINE, SYSLOG_INFO, SYSLOG_WARNING, SYSLOG_ERROR, SYSLOG_FAILURE} SysLogSeverity_enum;
+#define BBB_MAX_LOG_TEXT	64
+
+typedef enum {NULL_NOTIFICATION, MOTORS_INHIBIT, MOTORS_STARTING, MOTORS_DONE, MOTORS_ERRORS, NOTIFICATION_COUNT} Notification_enum;
+#define NOTIFICATION_NAMES {"none", "Motors Inhibit", "Motors Starting", "Motors Done", "Motors Errors"}
+
+#define formatmacro(e,t,v,s) e,
+typedef enum {
+#include "Messages/MsgFormatList.h"
+	PS_FORMAT_COUNT
+} psMsgFormat_enum;
+#undef formatmacro
+
+#define messagemacro(m,q,t,f,l) m,
+typedef enum {
+#include "Messages/MessageList.h"
+	PS_MSG_COUNT
+} psMessageType_enum;
+#undef messagemacro
+
+typedef struct {
+	uint8_t length;
+	uint8_t source;
+	uint8_t messageType;
+} psMessageHeader_t;
+
+typedef struct {
+	int32_t value;
+} psIntPayload_t;
+
+#define PS_NAME_LENGTH	16
+
+typedef struct {
+	char name[PS_NAME_LENGTH];
+	int32_t value;
+} psNameIntPayload_t;
+
+//benchmark payload - 'value' overlays intPayload
+typedef struct {
+	int32_t value;
+	uint32_t seq;
+	uint64_t sent;			//CLOCK_MONOTONIC nS at publish
+} psBenchPayload_t;
+
+#define PS_MAX_PAYLOAD	64
+
+typedef struct {
+	psMessageHeader_t header;
+	union {
+		uint8_t packet[PS_MAX_PAYLOAD];
+		psIntPayload_t intPayload;
+		psNameIntPayload_t nameIntPayload;
+		psBenchPayload_t benchPayload;
+	};
+} psMessage_t;
+
+extern char *subsystemNames[SUBSYSTEM_COUNT];
+extern char *psTopicNames[PS_TOPIC_COUNT];
+extern int psMsgFormats[PS_MSG_COUNT];
+extern int psDefaultTopics[PS_MSG_COUNT];
+extern char *psLongMsgNames[PS_MSG_COUNT];
+extern psQOS_enum psQOS[PS_MSG_COUNT];
+extern int psMessageFormatLengths[PS_FORMAT_COUNT];
+extern char *psNotificationNames[NOTIFICATION_COUNT];
+
+#endif /* PUBSUBDATA_H_ */
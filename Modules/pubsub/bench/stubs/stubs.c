@@ -0,0 +1,29 @@
+/*
+ * stubs.c
+ *
+ * Host stand-ins for the BBB-side services the broker core calls
+ *
+ *      Author: martin
+ */
+
+#include <stdio.h>
+
+#include "PubSubData.h"
+#include "Helpers.h"
+#include "common.h"
+
+void AdjustMessageLength(psMessage_t *msg)
+{
+	msg->header.length = psMessageFormatLengths[psMsgFormats[msg->header.messageType]];
+}
+
+void _LogMessage(SysLogSeverity_enum _severity, const char *_message, const char *_file)
+{
+	fprintf(stderr, "%s: %s\n", _file, _message);
+}
+
+//no pinmux on a host - the pty needs none
+int set_pinmux(const char *pinName, const char *newState)
+{
+	return 0;
+}
@@ -0,0 +1,209 @@
+/*
+ ============================================================================
+ Name        : uartBench.c
+ Author      : Martin
+ Description : UART receive benchmark against a pty stand-in. A writer thread
+ feeds the pty master at the serial rate in FIFO-sized chunks; the reader takes
+ it from the slave either a byte per read() (the old RxThread loop) or through
+ the buffered UartReader_t, and counts read() calls and thread CPU time.
+ ============================================================================
+ */
+
+#define _GNU_SOURCE			//posix_openpt, RUSAGE_THREAD
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "uart.h"
+
+//run parameters
+int byteRate = 11520;			//bytes/sec - 115200 baud
+int chunk = 16;					//bytes per write - UART FIFO trigger level
+int seconds = 2;
+int vmin = 1;					//buffered reader termios, as SoftwareProfile.h
+int vtime = 0;
+
+int master, slave;
+uint64_t toSend;
+
+uint64_t BenchNow()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+uint64_t ThreadCpuNs()
+{
+	struct rusage ru;
+	getrusage(RUSAGE_THREAD, &ru);
+	return (uint64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000
+			+ (uint64_t)(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000;
+}
+
+//paced writer - 'toSend' bytes of frames starting 0x01, as the PIC's STX
+void *WriterThread(void *arg)
+{
+	uint8_t buffer[256];
+	uint64_t sent = 0;
+	struct timespec next;
+	int i;
+
+	for (i=0; i<(int)sizeof(buffer); i++) buffer[i] = (i % 20 == 0 ? 0x01 : (uint8_t) i);
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+
+	while (sent < toSend)
+	{
+		int n = (int)(toSend - sent < (uint64_t) chunk ? toSend - sent : (uint64_t) chunk);
+		if (write(master, buffer, n) != n)
+		{
+			fprintf(stderr, "pty write: %s\n", strerror(errno));
+			break;
+		}
+		sent += n;
+
+		next.tv_nsec += (long)((1000000000LL * n) / byteRate);
+		while (next.tv_nsec >= 1000000000)
+		{
+			next.tv_sec++;
+			next.tv_nsec -= 1000000000;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+	}
+	return 0;
+}
+
+//stand-in for ParseNextCharacter - counts frame starts
+static inline int ParseByte(uint8_t c, uint32_t *frames)
+{
+	if (c == 0x01) (*frames)++;
+	return 0;
+}
+
+void RunReader(char *name, bool buffered)
+{
+	UartReader_t *reader = malloc(sizeof(UartReader_t));
+	pthread_t writer;
+	uint64_t received = 0, reads = 0;
+	uint32_t frames = 0;
+	uint8_t c;
+
+	if (buffered) uart_configure(slave, B115200, vmin, vtime);
+	else uart_configure(slave, B115200, 1, 0);
+	tcflush(slave, TCIOFLUSH);
+	uart_reader_init(reader, slave);
+
+	toSend = (uint64_t) byteRate * seconds;
+	uint64_t cpu = ThreadCpuNs();
+	uint64_t start = BenchNow();
+
+	pthread_create(&writer, NULL, WriterThread, NULL);
+
+	while (received < toSend)
+	{
+		if (buffered)
+		{
+			int next = uart_getc(reader);
+			if (next < 0) break;
+			ParseByte((uint8_t) next, &frames);
+			received++;
+		}
+		else
+		{
+			//the old RxThread loop
+			int count = (int) read(slave, &c, 1);
+			if (count == 1)
+			{
+				reads++;
+				ParseByte(c, &frames);
+				received++;
+			}
+		}
+	}
+
+	pthread_join(writer, NULL);
+
+	double elapsed = (BenchNow() - start) / 1e9;
+	cpu = ThreadCpuNs() - cpu;
+	if (buffered) reads = reader->reads;
+
+	printf("%-10s %10llu %8u %9llu %10.1f %9.1f %9.2f\n",
+			name, (unsigned long long) received, frames, (unsigned long long) reads,
+			(reads ? (double) received / reads : 0.0),
+			cpu / 1e6, (cpu / 1e3) / (received / 1024.0));
+	(void) elapsed;
+
+	free(reader);
+}
+
+void Usage(char *name)
+{
+	fprintf(stderr, "usage: %s [-b bytes/sec] [-c chunk] [-t seconds] [-m vmin] [-v vtime]\n", name);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "b:c:t:m:v:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'b':
+			byteRate = atoi(optarg);
+			break;
+		case 'c':
+			chunk = atoi(optarg);
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		case 'm':
+			vmin = atoi(optarg);
+			break;
+		case 'v':
+			vtime = atoi(optarg);
+			break;
+		default:
+			Usage(argv[0]);
+			break;
+		}
+	}
+	if (byteRate < 1 || chunk < 1 || chunk > 256 || seconds < 1) Usage(argv[0]);
+
+	master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0)
+	{
+		fprintf(stderr, "pty: %s\n", strerror(errno));
+		return 1;
+	}
+	slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+	if (slave < 0)
+	{
+		fprintf(stderr, "open %s: %s\n", ptsname(master), strerror(errno));
+		return 1;
+	}
+
+	printf("%i bytes/sec in %i byte writes for %i s, buffered vmin %i vtime %i\n",
+			byteRate, chunk, seconds, vmin, vtime);
+	printf("%-10s %10s %8s %9s %10s %9s %9s\n",
+			"reader", "bytes", "frames", "read()s", "bytes/read", "cpu mS", "uS/KB");
+
+	RunReader("byte", false);
+	RunReader("buffered", true);
+
+	return 0;
+}
@@ -0,0 +1,215 @@
+/*
+ * brokerDispatch.c
+ *
+ * Broker dispatcher pool - the single ingress path for published messages
+ *
+ * Each dispatcher is a routing thread with its own input queue. A message goes to the
+ * dispatcher that owns its default topic, so one topic is always routed by one thread,
+ * in publish order, while different topics route in parallel.
+ *
+ *      Author: martin
+ */
+
+#define _GNU_SOURCE			//pthread_setaffinity_np
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "PubSubData.h"
+#include "pubsub/pubsub.h"
+#include "syslog/syslog.h"
+#include "SoftwareProfile.h"
+
+#include "brokerQ.h"
+#include "broker_debug.h"
+
+#ifndef PS_DISPATCHERS
+#define PS_DISPATCHERS		1
+#endif
+
+typedef struct {
+	BrokerQueue_t queue;			//input queue - consumed by this dispatcher only
+	int cpu;						//pinned CPU, -1 = any
+	pthread_t thread;
+	char name[12];					//stats name
+} psDispatcher_t;
+
+psDispatcher_t psDispatchers[PS_MAX_DISPATCHERS];
+int psDispatcherCount = PS_DISPATCHERS;
+bool psDispatchCpusSet = false;
+
+//topic to dispatcher overrides - dispatcher + 1, 0 = by topic number
+uint8_t psTopicDispatcher[PS_TOPIC_COUNT];
+
+void *BrokerDispatchThread(void *arg);
+
+//the dispatcher that owns a (validated) message type
+static inline psDispatcher_t *TypeDispatcher(int messageType)
+{
+	unsigned topic = (unsigned) psDefaultTopics[messageType];
+	int d;
+
+	if (topic < PS_TOPIC_COUNT && psTopicDispatcher[topic])
+	{
+		d = (psTopicDispatcher[topic] - 1) % psDispatcherCount;
+	}
+	else
+	{
+		d = topic % psDispatcherCount;
+	}
+	return &psDispatchers[d];
+}
+
+//pool size and pinning - before the first publish
+//cpus[n] is the CPU for dispatcher n (-1 = any). NULL leaves them unpinned, or pinned in turn under PS_DISPATCH_PIN
+int psSetDispatchers(int count, const int cpus[])
+{
+	int i;
+
+	if (count < 1 || count > PS_MAX_DISPATCHERS)
+	{
+		ERRORPRINT("psSetDispatchers: %i out of range\n", count);
+		return -1;
+	}
+	psDispatcherCount = count;
+
+	if (cpus)
+	{
+		for (i=0; i<count; i++) psDispatchers[i].cpu = cpus[i];
+		psDispatchCpusSet = true;
+	}
+	return 0;
+}
+
+//route one topic on a chosen dispatcher - before the first publish
+int psSetTopicDispatcher(int topic, int dispatcher)
+{
+	if (topic < 0 || topic >= PS_TOPIC_COUNT) return -1;
+	if (dispatcher < 0 || dispatcher >= PS_MAX_DISPATCHERS) return -1;
+
+	psTopicDispatcher[topic] = dispatcher + 1;
+	return 0;
+}
+
+//depth policy for every dispatcher queue - before the first publish
+void psSetDispatchPolicy(int maxDepth, BrokerQueuePolicy_enum policy)
+{
+	int i;
+	for (i=0; i<PS_MAX_DISPATCHERS; i++)
+	{
+		SetQueuePolicy(&psDispatchers[i].queue, maxDepth, policy);
+	}
+}
+
+//start the dispatcher threads
+//messages published earlier are already waiting on the right queues
+int BrokerDispatchInit()
+{
+	int nprocs = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	int i;
+
+	for (i=0; i<psDispatcherCount; i++)
+	{
+		psDispatcher_t *d = &psDispatchers[i];
+
+		if (!psDispatchCpusSet)
+		{
+#ifdef PS_DISPATCH_PIN
+			d->cpu = i % nprocs;
+#else
+			d->cpu = -1;
+#endif
+		}
+
+		if (psDispatcherCount == 1)
+			snprintf(d->name, sizeof(d->name), "broker");
+		else
+			snprintf(d->name, sizeof(d->name), "broker%i", i);
+		psRegisterQueueStats(&d->queue, d->name);
+
+		int s = pthread_create(&d->thread, NULL, BrokerDispatchThread, d);
+		if (s != 0)
+		{
+			ERRORPRINT("dispatch pthread_create %i\n", s);
+			return s;
+		}
+
+		if (d->cpu >= 0)
+		{
+			cpu_set_t cpuset;
+			CPU_ZERO(&cpuset);
+			CPU_SET(d->cpu, &cpuset);
+
+			//unpinned is still correct, so carry on
+			s = pthread_setaffinity_np(d->thread, sizeof(cpu_set_t), &cpuset);
+			if (s != 0)
+			{
+				ERRORPRINT("%s: pin to CPU %i failed %s\n", d->name, d->cpu, strerror(s));
+			}
+		}
+		DEBUGPRINT("%s: dispatcher started, CPU %i of %i\n", d->name, d->cpu, nprocs);
+	}
+
+	PubSubBrokerReady = true;
+	return 0;
+}
+
+//publish a message - validated, copied and queued for its topic's dispatcher
+//returns -1 if the message is bad or cannot be queued
+int NewBrokerMessage(psMessage_t *msg)
+{
+	BrokerQueueEntry_t *e = GetFreeEntry();
+
+	if (e == NULL)
+	{
+		ERRORPRINT("Broker: no memory\n");
+		return -1;
+	}
+	memcpy(&e->msg, msg, sizeof(psMessage_t));
+	return NewBrokerEntry(e);
+}
+
+//publish an allocated entry - the caller's reference passes to the broker
+int NewBrokerEntry(BrokerQueueEntry_t *e)
+{
+	if (psValidateMessage(&e->msg) < 0)
+	{
+		__atomic_add_fetch(&brokerTypeStats[PS_MSG_COUNT].dropped, 1, __ATOMIC_RELAXED);
+		ReleaseQueueEntry(e);
+		return -1;
+	}
+	return AppendQueueEntry(&TypeDispatcher(e->msg.header.messageType)->queue, e);
+}
+
+//routes a batch at a time off one dispatcher queue
+void *BrokerDispatchThread(void *arg)
+{
+	psDispatcher_t *d = (psDispatcher_t *) arg;
+	psMessage_t *batch[BROKER_Q_BATCH];
+	int n, i;
+
+	while (1)
+	{
+		n = GetNextMessages(&d->queue, batch, BROKER_Q_BATCH, -1);
+
+		for (i=0; i<n; i++)
+		{
+			if (batch[i]->header.messageType != SYSLOG_MSG &&
+					batch[i]->header.messageType != BBBLOG_MSG)
+				TRACEPRINT("%s: %s\n", d->name, psLongMsgNames[batch[i]->header.messageType]);
+
+			RouteQueueEntry((BrokerQueueEntry_t *) batch[i]);
+		}
+
+		DoneWithMessages(batch, n);
+	}
+	return 0;
+}
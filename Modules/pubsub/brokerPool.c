@@ -0,0 +1,228 @@
+/*
+ * brokerPool.c
+ *
+ * Slab allocator for broker queue entries
+ *
+ * Each thread keeps a small magazine of free entries and only visits the shared depot
+ * (under depotMtx) to move half a magazine at a time. Entries are carved from slabs,
+ * pre-allocated by BrokerQueueInit, and never returned to the heap.
+ *
+ *      Author: martin
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "PubSubData.h"
+#include "brokerQ.h"
+#include "syslog/syslog.h"
+#include "broker_debug.h"
+
+//per-thread cache of free entries
+typedef struct {
+	int count;
+	BrokerQueueEntry_t *entry[BROKER_MAGAZINE_SIZE];
+} BrokerMagazine_t;
+
+static __thread BrokerMagazine_t magazine;
+
+//central depot - a list of free entries linked through 'next'
+BrokerQueueEntry_t *depot = NULL;
+pthread_mutex_t	depotMtx = PTHREAD_MUTEX_INITIALIZER;	//depot mutex
+
+BrokerPoolStats_t poolStats;
+
+//private
+int NewSlab();								//called from critical section
+void RefillMagazine(BrokerMagazine_t *m);
+void FlushMagazine(BrokerMagazine_t *m);
+
+//pre-allocate some entries on init
+int BrokerQueueInit(int pre)
+{
+	int reply = 0;
+
+	//critical section
+	int s = pthread_mutex_lock(&depotMtx);
+	if (s != 0)
+	{
+		ERRORPRINT("brokerPool: depot mutex lock %i\n", s);
+	}
+
+	while (poolStats.allocated < pre && reply == 0)
+	{
+		reply = NewSlab();
+	}
+
+	s = pthread_mutex_unlock(&depotMtx);
+	if (s != 0)
+	{
+		ERRORPRINT("brokerPool: depot mutex unlock %i\n", s);
+	}
+	//end critical section
+
+	return reply;
+}
+
+//get next free entry
+BrokerQueueEntry_t *GetFreeEntry()
+{
+	BrokerMagazine_t *m = &magazine;
+
+	if (m->count == 0)
+	{
+		RefillMagazine(m);
+		if (m->count == 0) return NULL;		//pool exhausted
+	}
+
+	BrokerQueueEntry_t *e = m->entry[--m->count];
+	e->next = NULL;
+	e->refCount = 1;
+	e->queued = 0;
+
+	uint32_t inUse = __atomic_add_fetch(&poolStats.inUse, 1, __ATOMIC_RELAXED);
+	uint32_t hwm = __atomic_load_n(&poolStats.inUseHWM, __ATOMIC_RELAXED);
+	while (inUse > hwm)
+	{
+		if (__atomic_compare_exchange_n(&poolStats.inUseHWM, &hwm, inUse, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+	}
+	return e;
+}
+
+//free a used entry
+void AddToFreelist(BrokerQueueEntry_t *e)
+{
+	BrokerMagazine_t *m = &magazine;
+
+	if (m->count == BROKER_MAGAZINE_SIZE)
+	{
+		FlushMagazine(m);
+	}
+	m->entry[m->count++] = e;
+
+	__atomic_sub_fetch(&poolStats.inUse, 1, __ATOMIC_RELAXED);
+}
+
+void BrokerPoolStats(BrokerPoolStats_t *stats)
+{
+	//critical section
+	int s = pthread_mutex_lock(&depotMtx);
+	if (s != 0)
+	{
+		ERRORPRINT("brokerPool: depot mutex lock %i\n", s);
+	}
+
+	*stats = poolStats;
+
+	s = pthread_mutex_unlock(&depotMtx);
+	if (s != 0)
+	{
+		ERRORPRINT("brokerPool: depot mutex unlock %i\n", s);
+	}
+	//end critical section
+}
+
+//take half a magazine from the depot, growing by a slab if the depot is empty
+void RefillMagazine(BrokerMagazine_t *m)
+{
+	//critical section
+	int s = pthread_mutex_lock(&depotMtx);
+	if (s != 0)
+	{
+		ERRORPRINT("brokerPool: depot mutex lock %i\n", s);
+	}
+
+	if (depot == NULL)
+	{
+		NewSlab();
+	}
+
+	while (depot && m->count < BROKER_MAGAZINE_SIZE / 2)
+	{
+		m->entry[m->count++] = depot;
+		depot = depot->next;
+		poolStats.depotCount--;
+	}
+	poolStats.refills++;
+
+	s = pthread_mutex_unlock(&depotMtx);
+	if (s != 0)
+	{
+		ERRORPRINT("brokerPool: depot mutex unlock %i\n", s);
+	}
+	//end critical section
+}
+
+//return half a magazine to the depot
+void FlushMagazine(BrokerMagazine_t *m)
+{
+	//chain the batch outside the lock
+	BrokerQueueEntry_t *first = NULL, *last = NULL;
+	int n = 0;
+	while (n < BROKER_MAGAZINE_SIZE / 2)
+	{
+		BrokerQueueEntry_t *e = m->entry[--m->count];
+		e->next = first;
+		first = e;
+		if (!last) last = e;
+		n++;
+	}
+
+	//critical section
+	int s = pthread_mutex_lock(&depotMtx);
+	if (s != 0)
+	{
+		ERRORPRINT("brokerPool: depot mutex lock %i\n", s);
+	}
+
+	last->next = depot;
+	depot = first;
+	poolStats.depotCount += n;
+	poolStats.flushes++;
+
+	s = pthread_mutex_unlock(&depotMtx);
+	if (s != 0)
+	{
+		ERRORPRINT("brokerPool: depot mutex unlock %i\n", s);
+	}
+	//end critical section
+}
+
+//carve a new slab into the depot
+//called from critical section
+int NewSlab()
+{
+	int i;
+
+	if (poolStats.allocated + BROKER_SLAB_ENTRIES > BROKER_POOL_MAX)
+	{
+		//hard cap
+		if ((poolStats.capHits++ & 0xff) == 0)
+		{
+			ERRORPRINT("brokerPool: cap of %i entries reached\n", BROKER_POOL_MAX);
+		}
+		return -1;
+	}
+
+	BrokerQueueEntry_t *slab = calloc(BROKER_SLAB_ENTRIES, sizeof(BrokerQueueEntry_t));
+	if (slab == NULL)
+	{
+		ERRORPRINT("brokerPool: no memory\n");
+		return -1;
+	}
+
+	for (i=0; i<BROKER_SLAB_ENTRIES; i++)
+	{
+		slab[i].next = depot;
+		depot = &slab[i];
+	}
+	poolStats.allocated += BROKER_SLAB_ENTRIES;
+	poolStats.depotCount += BROKER_SLAB_ENTRIES;
+	poolStats.slabs++;
+
+	return 0;
+}
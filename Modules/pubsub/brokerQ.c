@@ -13,32 +13,36 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <memory.h>
+#include <time.h>
+#include <errno.h>
+#include <sched.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #include "PubSubData.h"
 #include "brokerQ.h"
 #include "syslog/syslog.h"
 #include "broker_debug.h"
 
-BrokerQueueEntry_t *freelist = NULL;					//common free list
-pthread_mutex_t	freeMtx = PTHREAD_MUTEX_INITIALIZER;	//freelist mutex
+BrokerTypeStats_t brokerTypeStats[PS_MSG_COUNT + 1];		//last slot counts unknown types
 
 //private
-BrokerQueueEntry_t *NewQueueEntry();
-void AddToFreelist(BrokerQueueEntry_t *e);
-BrokerQueueEntry_t *GetFreeEntry();
+int TakeQueueEntries(BrokerQueue_t *q, BrokerQueueEntry_t *entries[], int max);
+int WaitQueueEntry(BrokerQueue_t *q, const struct timespec *deadline);
+int NextQueueTimer(BrokerQueue_t *q);
+void WaitQueueSpace(BrokerQueue_t *q, BrokerLane_t *lane, uint32_t limit);
+void RefuseQueueItem(BrokerQueue_t *q, BrokerQueueEntry_t *item);
+BrokerQueueEntry_t *TakeLaneSlot(BrokerLane_t *lane, uint32_t head);
+BrokerQueueEntry_t *ResolveQueueItem(BrokerQueue_t *q, BrokerQueueEntry_t *item);
+
+//coalesced types queue a marker in place of the entry - the entry itself waits in latest[type]
+//entries are pointer-aligned, so a set low bit cannot be a real entry
+#define COALESCE_MARKER(t)		((BrokerQueueEntry_t *)((((uintptr_t)(t)) << 1) | 1))
+#define IS_COALESCE_MARKER(e)	(((uintptr_t)(e)) & 1)
+#define MARKER_TYPE(e)			((int)(((uintptr_t)(e)) >> 1))
 
-//pre-allocate some entries on init
-int BrokerQueueInit(int pre)
-{
-	int i;
-	for (i=0; i<pre; i++)
-	{
-		BrokerQueueEntry_t *entry = NewQueueEntry();
-		if (entry == NULL) return -1;
-		AddToFreelist(entry);
-	}
-	return 0;
-}
 //add a new message to a queue
 int CopyMessageToQ(BrokerQueue_t *q, psMessage_t *msg)
 {
@@ -47,150 +51,520 @@ int CopyMessageToQ(BrokerQueue_t *q, psMessage_t *msg)
 	if (e != NULL)
 	{
 		memcpy(&e->msg, msg, sizeof(psMessage_t));
-		AppendQueueEntry(q, e);
-		return 0;
+		return AppendQueueEntry(q, e);
 	}
 	else return -1;
 }
 
+//counters for a message type - not yet validated on the way into the broker queue
+static inline BrokerTypeStats_t *TypeStats(int messageType)
+{
+	return &brokerTypeStats[((unsigned) messageType < PS_MSG_COUNT ? messageType : PS_MSG_COUNT)];
+}
+
+//lane for a message type - psQOS order, most urgent first
+//not yet validated - an unknown type goes to the last lane and is refused by the broker
+static inline int QueueLane(int messageType)
+{
+	if ((unsigned) messageType >= PS_MSG_COUNT) return BROKER_Q_LANES - 1;
+
+	int l = (int) psQOS[messageType];
+	if (l < 0) return 0;
+	if (l >= BROKER_Q_LANES) return BROKER_Q_LANES - 1;
+	return l;
+}
+
 //append an existing messageQ entry to a queue
-void AppendQueueEntry(BrokerQueue_t *q, BrokerQueueEntry_t *e)
+//lock-free - claim a slot in the entry's lane by CAS on the tail, then publish the pointer into it
+int AppendQueueEntry(BrokerQueue_t *q, BrokerQueueEntry_t *e)
 {
-	e->next = NULL;
+	int type = e->msg.header.messageType;
+	BrokerTypeStats_t *ts = TypeStats(type);
+	BrokerQueueEntry_t *item = e;
+	BrokerLane_t *lane = &q->lane[QueueLane(type)];
+	uint32_t limit = (q->maxDepth ? q->maxDepth : BROKER_Q_CAPACITY);
+
+	//one clock read per hop - fan-out appends share the first stamp
+	if (e->queued == 0) e->queued = BrokerNow();
+
+	__atomic_add_fetch(&ts->enqueued, 1, __ATOMIC_RELAXED);
 
-	//critical section
-	int s = pthread_mutex_lock(&q->mtx);
-	if (s != 0)
+	if ((unsigned) type < PS_MSG_COUNT && q->coalesce[type])
 	{
-		LogError("brokerQ: mutex lock %i", s);
+		BrokerQueueEntry_t *old = __atomic_exchange_n(&q->latest[type], e, __ATOMIC_ACQ_REL);
+		if (old != NULL)
+		{
+			//superseded before the consumer saw it - its marker is still queued
+			ReleaseQueueEntry(old);
+			__atomic_add_fetch(&q->coalesced, 1, __ATOMIC_RELAXED);
+			__atomic_add_fetch(&q->enqueued, 1, __ATOMIC_RELAXED);
+			__atomic_add_fetch(&ts->dropped, 1, __ATOMIC_RELAXED);
+			return 0;
+		}
+		item = COALESCE_MARKER(type);
 	}
 
-	int wake = 0;
-	if (q->qHead == NULL)
+	uint32_t tail;
+
+	while (1)
 	{
-		//Q empty
-		q->qHead = q->qTail = e;
-		wake = 1;
+		//head first - the consumer never passes the tail, so a later tail keeps tail - head a depth
+		uint32_t head = __atomic_load_n(&lane->qHead, __ATOMIC_ACQUIRE);
+		tail = __atomic_load_n(&lane->qTail, __ATOMIC_ACQUIRE);
+
+		//a blocking queue waits at its limit, even when that is the whole ring
+		if (q->policy == BROKER_Q_BLOCK && tail - head >= limit)
+		{
+			WaitQueueSpace(q, lane, limit);
+			continue;
+		}
+		if (tail - head >= BROKER_Q_CAPACITY)
+		{
+			//ring full - refuse rather than grow
+			uint32_t n = __atomic_add_fetch(&lane->overflows, 1, __ATOMIC_RELAXED);
+			if ((n & (n - 1)) == 0)
+			{
+				//report 1st, 2nd, 4th, 8th... overflow
+				ERRORPRINT("brokerQ: lane %i full, %u dropped\n", (int)(lane - q->lane), n);
+			}
+			RefuseQueueItem(q, item);
+			__atomic_add_fetch(&ts->dropped, 1, __ATOMIC_RELAXED);
+			return -1;
+		}
+		//urgent lane 0 is never trimmed - under DROP_OLDEST it refuses at the limit too
+		if (tail - head >= limit && (q->policy != BROKER_Q_DROP_OLDEST || lane == &q->lane[0]))
+		{
+			uint32_t n = __atomic_add_fetch(&q->dropped, 1, __ATOMIC_RELAXED);
+			if ((n & (n - 1)) == 0)
+			{
+				ERRORPRINT("brokerQ: lane %i at depth limit, %u dropped (%s)\n", (int)(lane - q->lane), n,
+						((unsigned) type < PS_MSG_COUNT ? psLongMsgNames[type] : "unknown"));
+			}
+			RefuseQueueItem(q, item);
+			__atomic_add_fetch(&ts->dropped, 1, __ATOMIC_RELAXED);
+			return -1;
+		}
+		//BROKER_Q_DROP_OLDEST - accepted, the consumer trims lanes after the first back to maxDepth
+		if (__atomic_compare_exchange_n(&lane->qTail, &tail, tail + 1, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) break;
 	}
-	else
+
+	__atomic_store_n(&lane->slot[tail & BROKER_Q_MASK], item, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&q->enqueued, 1, __ATOMIC_RELAXED);
+
+	//wake the consumer only if it is parked
+	__atomic_add_fetch(&q->wakeSeq, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&q->sleeping, __ATOMIC_SEQ_CST))
 	{
-		q->qTail->next = e;
-		q->qTail = e;
+		syscall(SYS_futex, &q->wakeSeq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
 	}
-	s = pthread_mutex_unlock(&q->mtx);
-	if (s != 0)
+	return 0;
+}
+
+//drop an item that could not be queued
+void RefuseQueueItem(BrokerQueue_t *q, BrokerQueueEntry_t *item)
+{
+	if (IS_COALESCE_MARKER(item))
 	{
-		LogError("brokerQ: mutex unlock %i", s);
+		//no marker will be queued, so nothing may be left pending
+		item = __atomic_exchange_n(&q->latest[MARKER_TYPE(item)], NULL, __ATOMIC_ACQ_REL);
+		if (item == NULL) return;
 	}
-	//end critical section
+	ReleaseQueueEntry(item);
+}
+
+//BROKER_Q_BLOCK - park a producer until the consumer takes from the queue
+void WaitQueueSpace(BrokerQueue_t *q, BrokerLane_t *lane, uint32_t limit)
+{
+	__atomic_add_fetch(&q->blocked, 1, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&q->blocks, 1, __ATOMIC_RELAXED);
+
+	uint32_t seq = __atomic_load_n(&q->spaceSeq, __ATOMIC_SEQ_CST);
+	uint32_t head = __atomic_load_n(&lane->qHead, __ATOMIC_SEQ_CST);
+	uint32_t depth = __atomic_load_n(&lane->qTail, __ATOMIC_SEQ_CST) - head;
 
-	if (wake) pthread_cond_signal(&q->cond);
+	if (depth >= limit)
+	{
+		//returns at once if the consumer bumped spaceSeq since we sampled it
+		int s = syscall(SYS_futex, &q->spaceSeq, FUTEX_WAIT_PRIVATE, seq, NULL, NULL, 0);
+		if (s != 0 && errno != EAGAIN && errno != EINTR)
+		{
+			LogError("brokerQ: futex space wait %i", errno);
+		}
+	}
+	__atomic_sub_fetch(&q->blocked, 1, __ATOMIC_SEQ_CST);
 }
+
 bool isQueueEmpty(BrokerQueue_t *q)
 {
-	return (q->qHead == NULL);
+	int l;
+	for (l=0; l<BROKER_Q_LANES; l++)
+	{
+		if (__atomic_load_n(&q->lane[l].qTail, __ATOMIC_ACQUIRE) != q->lane[l].qHead) return false;
+	}
+	return true;
+}
+
+//take the item in a claimed slot
+//consumer thread only
+BrokerQueueEntry_t *TakeLaneSlot(BrokerLane_t *lane, uint32_t head)
+{
+	BrokerQueueEntry_t *item;
+
+	//slot claimed but the producer may not have stored the pointer yet
+	while ((item = __atomic_load_n(&lane->slot[head & BROKER_Q_MASK], __ATOMIC_ACQUIRE)) == NULL)
+	{
+		sched_yield();
+	}
+	lane->slot[head & BROKER_Q_MASK] = NULL;
+	return item;
 }
 
-//get the first message or wait
-//returns a reference to the message
-psMessage_t *GetNextMessage(BrokerQueue_t *q)
+//the entry behind a queue item - a coalesce marker yields the latest message of its type
+BrokerQueueEntry_t *ResolveQueueItem(BrokerQueue_t *q, BrokerQueueEntry_t *item)
+{
+	if (IS_COALESCE_MARKER(item))
+	{
+		return __atomic_exchange_n(&q->latest[MARKER_TYPE(item)], NULL, __ATOMIC_ACQ_REL);
+	}
+	return item;
+}
+
+//take up to 'max' entries in one pass, returns the number taken
+//highest priority lane first, but a lane passed over BROKER_Q_STARVE times is served next
+//consumer thread only
+int TakeQueueEntries(BrokerQueue_t *q, BrokerQueueEntry_t *entries[], int max)
 {
 	BrokerQueueEntry_t *e;
+	uint32_t head[BROKER_Q_LANES];
+	uint32_t tail[BROKER_Q_LANES];
+	bool taken = false;
+	uint32_t depth = 0;
+	int l, take, i;
+	int n = 0;
+
+	//one snapshot of the tails for the whole batch
+	for (l=0; l<BROKER_Q_LANES; l++)
+	{
+		head[l] = q->lane[l].qHead;
+		tail[l] = __atomic_load_n(&q->lane[l].qTail, __ATOMIC_ACQUIRE);
+
+		if (q->policy == BROKER_Q_DROP_OLDEST && q->maxDepth && l > 0)
+		{
+			//trim back to the depth limit, oldest first
+			while (tail[l] - head[l] > q->maxDepth)
+			{
+				e = ResolveQueueItem(q, TakeLaneSlot(&q->lane[l], head[l]++));
+				if (e)
+				{
+					__atomic_add_fetch(&TypeStats(e->msg.header.messageType)->dropped, 1, __ATOMIC_RELAXED);
+					ReleaseQueueEntry(e);
+				}
+				__atomic_add_fetch(&q->dropped, 1, __ATOMIC_RELAXED);
+			}
+		}
+		depth += tail[l] - head[l];
+	}
+	if (depth > q->depthHWM) __atomic_store_n(&q->depthHWM, depth, __ATOMIC_RELAXED);
 
-	//critical section
-	int s = pthread_mutex_lock(&q->mtx);
-	if (s != 0)
+	while (n < max)
 	{
-		LogError("brokerQ: mutex lock %i", s);
+		take = -1;
+		for (l=0; l<BROKER_Q_LANES; l++)
+		{
+			if (head[l] == tail[l]) continue;
+			if (take < 0) take = l;
+			else if (q->lane[l].passed >= BROKER_Q_STARVE)
+			{
+				take = l;
+				break;
+			}
+		}
+		if (take < 0) break;
+
+		for (l=0; l<BROKER_Q_LANES; l++)
+		{
+			if (head[l] != tail[l]) q->lane[l].passed++;
+		}
+		q->lane[take].passed = 0;
+
+		e = ResolveQueueItem(q, TakeLaneSlot(&q->lane[take], head[take]++));
+		if (e) entries[n++] = e;
 	}
-	//empty wait case
-	while (q->qHead == NULL) pthread_cond_wait(&q->cond, &q->mtx);
 
-	e = q->qHead;
-	q->qHead = e->next;
-	e->next = NULL;
-	if (q->qHead == NULL)
+	if (n > 0)
 	{
-		//end of queue
-		q->qTail = NULL;
+		//queue wait - one clock read per batch
+		uint64_t now = BrokerNow();
+		uint64_t wait = 0;
+		for (i=0; i<n; i++)
+		{
+			uint64_t w = (entries[i]->queued ? now - entries[i]->queued : 0);
+			BrokerTypeStats_t *ts = TypeStats(entries[i]->msg.header.messageType);
+			__atomic_add_fetch(&ts->dequeued, 1, __ATOMIC_RELAXED);
+			__atomic_add_fetch(&ts->waitNs, w, __ATOMIC_RELAXED);
+			wait += w;
+		}
+		__atomic_store_n(&q->dequeued, q->dequeued + n, __ATOMIC_RELAXED);
+		__atomic_store_n(&q->waitNs, q->waitNs + wait, __ATOMIC_RELAXED);
 	}
 
-	s = pthread_mutex_unlock(&q->mtx);
-	if (s != 0)
+	//one release per lane for the whole batch
+	for (l=0; l<BROKER_Q_LANES; l++)
 	{
-		LogError("brokerQ: mutex unlock %i", s);
+		if (head[l] != q->lane[l].qHead)
+		{
+			__atomic_store_n(&q->lane[l].qHead, head[l], __ATOMIC_RELEASE);
+			taken = true;
+		}
 	}
-	//end critical section
 
-	return (psMessage_t*) e;
+	if (taken && q->policy == BROKER_Q_BLOCK)
+	{
+		//pairs with WaitQueueSpace - either it sees the new head or we see it blocked
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&q->blocked, __ATOMIC_SEQ_CST))
+		{
+			__atomic_add_fetch(&q->spaceSeq, 1, __ATOMIC_SEQ_CST);
+			syscall(SYS_futex, &q->spaceSeq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+		}
+	}
+	return n;
 }
 
-//release a message queue entry when done
-void DoneWithMessage(psMessage_t *msg)
+//depth limit (per lane) and what to do when it is reached
+void SetQueuePolicy(BrokerQueue_t *q, int maxDepth, BrokerQueuePolicy_enum policy)
+{
+	if (maxDepth <= 0 || maxDepth > BROKER_Q_CAPACITY) maxDepth = BROKER_Q_CAPACITY;
+
+	q->maxDepth = maxDepth;
+	q->policy = policy;
+}
+
+//only the latest pending message of this type is kept
+int SetQueueCoalesce(BrokerQueue_t *q, psMessageType_enum messageType)
 {
-	AddToFreelist((BrokerQueueEntry_t *)msg);
+	if (messageType < 0 || messageType >= PS_MSG_COUNT) return -1;
+
+	q->coalesce[messageType] = 1;
+	return 0;
 }
 
-//allocate a queue entry
-BrokerQueueEntry_t *NewQueueEntry()
+void BrokerQueueStats(BrokerQueue_t *q, BrokerQueueStats_t *stats)
 {
-	BrokerQueueEntry_t *e = calloc(1, sizeof(BrokerQueueEntry_t));
-	if (e == NULL)
+	int l;
+
+	memset(stats, 0, sizeof(BrokerQueueStats_t));
+	for (l=0; l<BROKER_Q_LANES; l++)
+	{
+		uint32_t head = __atomic_load_n(&q->lane[l].qHead, __ATOMIC_ACQUIRE);
+		stats->pending += __atomic_load_n(&q->lane[l].qTail, __ATOMIC_RELAXED) - head;
+		stats->overflows += __atomic_load_n(&q->lane[l].overflows, __ATOMIC_RELAXED);
+	}
+	stats->enqueued = __atomic_load_n(&q->enqueued, __ATOMIC_RELAXED);
+	stats->dequeued = __atomic_load_n(&q->dequeued, __ATOMIC_RELAXED);
+	stats->depthHWM = __atomic_load_n(&q->depthHWM, __ATOMIC_RELAXED);
+	stats->dropped = __atomic_load_n(&q->dropped, __ATOMIC_RELAXED);
+	stats->coalesced = __atomic_load_n(&q->coalesced, __ATOMIC_RELAXED);
+	stats->blocks = __atomic_load_n(&q->blocks, __ATOMIC_RELAXED);
+	stats->waitNs = __atomic_load_n(&q->waitNs, __ATOMIC_RELAXED);
+}
+
+//park the consumer until an append or the (CLOCK_MONOTONIC) deadline
+//returns -1 on timeout
+int WaitQueueEntry(BrokerQueue_t *q, const struct timespec *deadline)
+{
+	int reply = 0;
+	uint32_t seq = __atomic_load_n(&q->wakeSeq, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&q->sleeping, 1, __ATOMIC_SEQ_CST);
+
+	if (isQueueEmpty(q))
+	{
+		//returns at once if an append bumped wakeSeq since we sampled it
+		int s = syscall(SYS_futex, &q->wakeSeq, FUTEX_WAIT_BITSET_PRIVATE, seq, deadline, NULL, FUTEX_BITSET_MATCH_ANY);
+		if (s != 0)
+		{
+			switch (errno)
+			{
+			case ETIMEDOUT:
+				reply = -1;
+				break;
+			case EAGAIN:
+			case EINTR:
+				break;
+			default:
+				LogError("brokerQ: futex wait %i", errno);
+				break;
+			}
+		}
+	}
+	__atomic_store_n(&q->sleeping, 0, __ATOMIC_RELAXED);
+	return reply;
+}
+
+//get the first message or wait
+//returns a reference to the message
+psMessage_t *GetNextMessage(BrokerQueue_t *q)
+{
+	BrokerQueueEntry_t *e;
+
+	while (TakeQueueEntries(q, &e, 1) == 0)
 	{
-		LogError("brokerQ: no memory");
+		//empty wait case
+		WaitQueueEntry(q, NULL);
 	}
-	return e;
+
+	return (psMessage_t*) e;
 }
 
-//free a used entry
-void AddToFreelist(BrokerQueueEntry_t *e)
+//get everything pending (up to max), waiting up to 'timeout' mS if empty (-1 = forever, 0 = no wait)
+//returns the number of messages (call DoneWithMessages!)
+int GetNextMessages(BrokerQueue_t *q, psMessage_t *msgs[], int max, int timeout)
 {
-	//critical section
-	int s = pthread_mutex_lock(&freeMtx);
-	if (s != 0)
+	struct timespec deadline;
+	int n;
+
+	if (timeout > 0)
 	{
-		LogError("brokerQ: freelist mutex lock %i", s);
+		BrokerDeadline(&deadline, timeout);
 	}
-	e->next = freelist;
-	freelist = e;
 
-	s = pthread_mutex_unlock(&freeMtx);
-	if (s != 0)
+	//entries start with the message, so the entry array doubles as the message array
+	while ((n = TakeQueueEntries(q, (BrokerQueueEntry_t **) msgs, max)) == 0)
 	{
-		LogError("brokerQ: freelist mutex unlock %i", s);
+		if (timeout == 0) break;
+		if (WaitQueueEntry(q, (timeout > 0 ? &deadline : NULL)) < 0) break;
 	}
-	//end critical section
+	return n;
 }
 
-//get next free entry
-BrokerQueueEntry_t *GetFreeEntry()
+//get the first message or wait until the deadline
+//returns NULL on timeout
+psMessage_t *GetNextMessageTimed(BrokerQueue_t *q, const struct timespec *deadline)
 {
 	BrokerQueueEntry_t *e;
 
-	//critical section
-	int s = pthread_mutex_lock(&freeMtx);
-	if (s != 0)
+	while (TakeQueueEntries(q, &e, 1) == 0)
 	{
-		LogError("brokerQ: freelist mutex lock %i", s);
+		if (WaitQueueEntry(q, deadline) < 0) return NULL;
 	}
 
-	if (freelist)
+	return (psMessage_t*) e;
+}
+
+//get pending messages or the next expired timer
+int GetQueueEvents(BrokerQueue_t *q, psMessage_t *msgs[], int max, int *timer)
+{
+	struct timespec now;
+	int n, t;
+
+	while (1)
 	{
-		e = freelist;
-		freelist = e->next;
-		e->next = NULL;
+		t = NextQueueTimer(q);
+		if (t >= 0)
+		{
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			if (now.tv_sec > q->timer[t].tv_sec
+					|| (now.tv_sec == q->timer[t].tv_sec && now.tv_nsec >= q->timer[t].tv_nsec))
+			{
+				//expired - one shot
+				q->timersArmed &= ~(1 << t);
+				*timer = t;
+				return 0;
+			}
+		}
+
+		if ((n = TakeQueueEntries(q, (BrokerQueueEntry_t **) msgs, max)) > 0) return n;
+
+		//sleep until an append or the earliest timer
+		WaitQueueEntry(q, (t >= 0 ? &q->timer[t] : NULL));
 	}
-	else
+}
+
+//(re)arm a one-shot timer
+void SetQueueTimer(BrokerQueue_t *q, int timer, int mS)
+{
+	if (timer < 0 || timer >= BROKER_Q_TIMERS) return;
+
+	BrokerDeadline(&q->timer[timer], mS);
+	q->timersArmed |= (1 << timer);
+}
+
+void CancelQueueTimer(BrokerQueue_t *q, int timer)
+{
+	if (timer < 0 || timer >= BROKER_Q_TIMERS) return;
+
+	q->timersArmed &= ~(1 << timer);
+}
+
+//earliest armed timer, -1 if none
+int NextQueueTimer(BrokerQueue_t *q)
+{
+	int i;
+	int next = -1;
+
+	for (i=0; i<BROKER_Q_TIMERS; i++)
 	{
-		e = NewQueueEntry();
+		if (q->timersArmed & (1 << i))
+		{
+			if (next < 0
+					|| q->timer[i].tv_sec < q->timer[next].tv_sec
+					|| (q->timer[i].tv_sec == q->timer[next].tv_sec && q->timer[i].tv_nsec < q->timer[next].tv_nsec))
+			{
+				next = i;
+			}
+		}
 	}
+	return next;
+}
+
+//CLOCK_MONOTONIC in nS
+uint64_t BrokerNow()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
 
-	s = pthread_mutex_unlock(&freeMtx);
-	if (s != 0)
+//absolute CLOCK_MONOTONIC time mS from now
+void BrokerDeadline(struct timespec *deadline, int mS)
+{
+	clock_gettime(CLOCK_MONOTONIC, deadline);
+	deadline->tv_sec += mS / 1000;
+	deadline->tv_nsec += (mS % 1000) * 1000000;
+	if (deadline->tv_nsec >= 1000000000)
 	{
-		LogError("brokerQ: freelist mutex unlock %i", s);
+		deadline->tv_sec++;
+		deadline->tv_nsec -= 1000000000;
 	}
-	//end critical section
+}
 
-	return e;
+//release a message queue entry when done
+void DoneWithMessage(psMessage_t *msg)
+{
+	ReleaseQueueEntry((BrokerQueueEntry_t *)msg);
+}
+
+//release a batch from GetNextMessages
+void DoneWithMessages(psMessage_t *msgs[], int count)
+{
+	int i;
+	for (i=0; i<count; i++)
+	{
+		ReleaseQueueEntry((BrokerQueueEntry_t *)msgs[i]);
+	}
+}
+
+//add references to an entry about to be placed on more queues
+void RetainQueueEntry(BrokerQueueEntry_t *e, int refs)
+{
+	__atomic_add_fetch(&e->refCount, refs, __ATOMIC_RELAXED);
+}
+
+//drop a reference - the last holder returns the entry to the pool
+void ReleaseQueueEntry(BrokerQueueEntry_t *e)
+{
+	if (__atomic_sub_fetch(&e->refCount, 1, __ATOMIC_ACQ_REL) == 0)
+	{
+		AddToFreelist(e);
+	}
 }
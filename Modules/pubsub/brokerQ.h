@@ -11,37 +11,171 @@
 #define BROKERQ_H_
 
 #include <stdio.h>
+#include <stdint.h>
+#include <time.h>
 #include "pthread.h"
 
 #include "PubSubData.h"
 
 //queue item struct
-//just a message and a next pointer
+//a message, a next pointer (freelist link) and a reference count
+//an entry may sit on several queues at once (zero-copy fan-out) - it returns to the pool on the last release
 typedef struct {
 	psMessage_t msg;
 	void *next;
+	int refCount;
+	uint64_t queued;		//CLOCK_MONOTONIC nS when first appended on this hop (0 = not yet)
 } BrokerQueueEntry_t;
 
+//ring size - must be a power of 2
+#define BROKER_Q_CAPACITY	128
+#define BROKER_Q_MASK		(BROKER_Q_CAPACITY - 1)
+
+//BBB (Cortex-A8) L1 line size
+#define BROKER_CACHE_LINE	64
+
+//one-shot timers per queue
+#define BROKER_Q_TIMERS		4
+
+//priority lanes - selected by psQOS[messageType], lane 0 (first QOS value) is served first
+#define BROKER_Q_LANES		3
+#define BROKER_Q_STARVE		8		//a waiting lower lane is served after being passed over this many times
+
+//one lane - a fixed-capacity ring of entry pointers. Any thread may append, only the owning thread may take.
+//producer and consumer indices sit on separate cache lines
+typedef struct {
+	//producer side
+	uint32_t qTail __attribute__((aligned(BROKER_CACHE_LINE)));	//next slot to claim
+	uint32_t overflows;				//appends refused because the ring was full
+
+	//consumer side
+	uint32_t qHead __attribute__((aligned(BROKER_CACHE_LINE)));	//next slot to take
+	uint32_t passed;				//takes from other lanes while this one waited
+
+	BrokerQueueEntry_t *slot[BROKER_Q_CAPACITY] __attribute__((aligned(BROKER_CACHE_LINE)));
+} BrokerLane_t;
+
+//depth policies - what an append does when its lane already holds maxDepth entries
+typedef enum {
+	BROKER_Q_DROP_NEWEST,		//refuse the new entry (default)
+	BROKER_Q_DROP_OLDEST,		//accept it, the consumer discards the oldest on its next take - urgent lane 0 refuses instead
+	BROKER_Q_BLOCK				//wait for the consumer - never from the consuming thread
+} BrokerQueuePolicy_enum;
+
 //queue struct - allocated and kept by the owning subsystem
-//list head and tail, plus mutex and condition variable for signalling
 typedef struct {
-	BrokerQueueEntry_t *qHead, *qTail;
-	pthread_mutex_t mtx;	//access control
-	pthread_cond_t cond;	//signals item in previously empty queue
+	BrokerLane_t lane[BROKER_Q_LANES];
+
+	//producer side
+	uint32_t wakeSeq __attribute__((aligned(BROKER_CACHE_LINE)));	//futex word - bumped on every append
+	uint32_t blocked;				//producers waiting on spaceSeq
+	uint32_t dropped;				//discarded by the depth policy
+	uint32_t coalesced;				//superseded before the consumer took them
+	uint32_t blocks;				//appends that had to wait
+	uint32_t enqueued;				//appends accepted
+
+	//consumer side
+	uint32_t sleeping __attribute__((aligned(BROKER_CACHE_LINE)));	//consumer is parked on wakeSeq
+	uint32_t spaceSeq;				//futex word - bumped when blocked producers may retry
+	uint32_t dequeued;				//entries taken
+	uint32_t depthHWM;				//deepest backlog seen by the consumer
+	uint64_t waitNs;				//cumulative append-to-take time
+	uint32_t timersArmed;			//bitmap of armed timers
+	struct timespec timer[BROKER_Q_TIMERS];	//CLOCK_MONOTONIC expiry times
+
+	//policy - set up before use
+	uint16_t maxDepth;				//per lane, 0 = BROKER_Q_CAPACITY
+	uint8_t policy;					//BrokerQueuePolicy_enum
+	uint8_t coalesce[PS_MSG_COUNT];	//types that keep only their latest pending message
+
+	BrokerQueueEntry_t *latest[PS_MSG_COUNT] __attribute__((aligned(BROKER_CACHE_LINE)));	//pending coalesced entries
 } BrokerQueue_t;
-#define BROKER_Q_INITIALIZER {NULL, NULL, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER}
+#define BROKER_Q_INITIALIZER {0}
 
-int BrokerQueueInit(int pre);							//one init to pre-allocate shared pool of queue entries
+int CopyMessageToQ(BrokerQueue_t *q, psMessage_t *msg);				//appends to queue, -1 if full
+
+int AppendQueueEntry(BrokerQueue_t *q, BrokerQueueEntry_t *e);		//appends an allocated message q entry to its QOS lane (entry is released if full)
+
+//queue policy - call before the queue is in use
+void SetQueuePolicy(BrokerQueue_t *q, int maxDepth, BrokerQueuePolicy_enum policy);
+int SetQueueCoalesce(BrokerQueue_t *q, psMessageType_enum messageType);	//newer messages replace a pending one
+
+typedef struct {
+	uint32_t pending;			//entries waiting, all lanes
+	uint32_t enqueued;			//appends accepted
+	uint32_t dequeued;			//entries taken
+	uint32_t depthHWM;			//deepest backlog seen
+	uint32_t overflows;			//refused because a ring was full
+	uint32_t dropped;			//discarded by the depth policy
+	uint32_t coalesced;			//superseded before being taken
+	uint32_t blocks;			//appends that waited for space
+	uint64_t waitNs;			//cumulative append-to-take time
+} BrokerQueueStats_t;
+
+void BrokerQueueStats(BrokerQueue_t *q, BrokerQueueStats_t *stats);	//snapshot of queue counters
 
-int CopyMessageToQ(BrokerQueue_t *q, psMessage_t *msg);				//appends to queue
+//per message type counters, across all queues
+typedef struct {
+	uint32_t enqueued;			//appends accepted
+	uint32_t dequeued;			//entries taken
+	uint32_t dropped;			//refused, discarded or coalesced
+	uint64_t waitNs;			//cumulative append-to-take time
+} BrokerTypeStats_t;
 
-void AppendQueueEntry(BrokerQueue_t *q, BrokerQueueEntry_t *e);		//appends an allocated message q entry
+extern BrokerTypeStats_t brokerTypeStats[PS_MSG_COUNT + 1];		//last slot counts unknown types
 
 psMessage_t *GetNextMessage(BrokerQueue_t *q);			//waits if empty, returns pointer (call DoneWithMessage!)
+
+#define BROKER_Q_BATCH	16		//typical batch for GetNextMessages
+
+//takes everything pending up to max in one pass, in lane priority order. waits up to timeout mS if empty (-1 forever, 0 no wait)
+//returns count, 0 on timeout (call DoneWithMessages!)
+int GetNextMessages(BrokerQueue_t *q, psMessage_t *msgs[], int max, int timeout);
+
+//waits until an absolute CLOCK_MONOTONIC deadline (NULL = forever). returns NULL on timeout
+psMessage_t *GetNextMessageTimed(BrokerQueue_t *q, const struct timespec *deadline);
+
+//queue timers - owning thread only
+void SetQueueTimer(BrokerQueue_t *q, int timer, int mS);	//(re)arm 'timer' to expire mS from now
+void CancelQueueTimer(BrokerQueue_t *q, int timer);
+
+//as GetNextMessages, but also wakes for the queue timers
+//returns count, or 0 with *timer set to the expired timer (now disarmed). expired timers come first
+int GetQueueEvents(BrokerQueue_t *q, psMessage_t *msgs[], int max, int *timer);
+
+void BrokerDeadline(struct timespec *deadline, int mS);	//CLOCK_MONOTONIC time mS from now
+uint64_t BrokerNow();									//CLOCK_MONOTONIC nS
+
 bool isQueueEmpty(BrokerQueue_t *q);
 
-void DoneWithMessage(psMessage_t *msg);					//when done with message Q entry -> freelist
+void DoneWithMessage(psMessage_t *msg);					//when done with message Q entry -> drop reference -> freelist
+void DoneWithMessages(psMessage_t *msgs[], int count);	//release a batch
+
+void RetainQueueEntry(BrokerQueueEntry_t *e, int refs);	//add references before sharing an entry
+void ReleaseQueueEntry(BrokerQueueEntry_t *e);			//drop a reference, last one returns the entry to the pool
+
+//queue entry pool (brokerPool.c)
+#define BROKER_MAGAZINE_SIZE	16		//free entries cached per thread
+#define BROKER_SLAB_ENTRIES		64		//entries per slab allocation
+#define BROKER_POOL_PRELOAD		512		//entries allocated at init
+#define BROKER_POOL_MAX			2048	//hard cap - GetFreeEntry returns NULL beyond this
+
+typedef struct {
+	uint32_t allocated;			//entries carved from slabs
+	uint32_t slabs;
+	uint32_t inUse;				//entries handed out and not yet released
+	uint32_t inUseHWM;			//high-water mark of inUse
+	uint32_t depotCount;		//entries sitting in the central depot
+	uint32_t refills;			//magazine refills from the depot
+	uint32_t flushes;			//magazine returns to the depot
+	uint32_t capHits;			//slab allocations refused by BROKER_POOL_MAX
+} BrokerPoolStats_t;
+
+int BrokerQueueInit(int pre);							//one init to pre-allocate shared pool of queue entries
+
+BrokerQueueEntry_t *GetFreeEntry();						//new broker q entry <- thread magazine <- depot
+void AddToFreelist(BrokerQueueEntry_t *e);				//used entry -> thread magazine -> depot
 
-BrokerQueueEntry_t *GetFreeEntry();						//new broker q entry <- freelist
+void BrokerPoolStats(BrokerPoolStats_t *stats);			//snapshot of pool counters
 
 #endif /* BROKER_H_ */
@@ -0,0 +1,236 @@
+/*
+ * brokerStats.c
+ *
+ * Broker counters - written to a stats file and published as GEN_STATS
+ *
+ * The counters themselves live in the queues and brokerTypeStats (brokerQ.c).
+ * This thread only reads them, so the routing path takes no locks for stats.
+ * Other subsystems (the serial link) add their own counters through a reporter.
+ *
+ *      Author: martin
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "PubSubData.h"
+#include "pubsub/pubsub.h"
+#include "syslog/syslog.h"
+#include "SoftwareProfile.h"
+
+#include "brokerQ.h"
+#include "broker_debug.h"
+
+//named queues reported on
+typedef struct {
+	char *name;
+	BrokerQueue_t *queue;
+	BrokerQueueStats_t last;		//at the previous publish - stats thread only
+} psStatsQueue_t;
+
+psStatsQueue_t psStatsQueues[PS_MAX_STATS_QUEUES];
+int psStatsQueueCount = 0;
+psStatsReporter_t psStatsReporters[PS_MAX_STATS_REPORTERS];
+int psStatsReporterCount = 0;
+pthread_mutex_t	statsMtx = PTHREAD_MUTEX_INITIALIZER;
+
+void *BrokerStatsThread(void *arg);
+void PublishQueueStats(psStatsQueue_t *sq);
+
+pthread_t BrokerStatsInit()
+{
+	pthread_t thread;
+	int s = pthread_create(&thread, NULL, BrokerStatsThread, NULL);
+	if (s != 0)
+	{
+		ERRORPRINT("stats pthread_create %i\n", s);
+		return s;
+	}
+	return thread;
+}
+
+//add a queue to the stats report
+//the entry is stored before the count is published, as psSubscribe
+int psRegisterQueueStats(BrokerQueue_t *q, char *name)
+{
+	int reply = 0;
+
+	//critical section
+	int s = pthread_mutex_lock(&statsMtx);
+	if (s != 0)
+	{
+		ERRORPRINT("psRegisterQueueStats: mutex lock %i\n", s);
+	}
+
+	if (psStatsQueueCount < PS_MAX_STATS_QUEUES)
+	{
+		psStatsQueues[psStatsQueueCount].name = name;
+		psStatsQueues[psStatsQueueCount].queue = q;
+		__atomic_store_n(&psStatsQueueCount, psStatsQueueCount + 1, __ATOMIC_RELEASE);
+	}
+	else
+	{
+		ERRORPRINT("psRegisterQueueStats: too many queues (%s)\n", name);
+		reply = -1;
+	}
+
+	s = pthread_mutex_unlock(&statsMtx);
+	if (s != 0)
+	{
+		ERRORPRINT("psRegisterQueueStats: mutex unlock %i\n", s);
+	}
+	//end critical section
+
+	return reply;
+}
+
+//add a reporter, called from the stats thread each period
+int psRegisterStatsReporter(psStatsReporter_t reporter)
+{
+	int reply = 0;
+
+	//critical section
+	int s = pthread_mutex_lock(&statsMtx);
+	if (s != 0)
+	{
+		ERRORPRINT("psRegisterStatsReporter: mutex lock %i\n", s);
+	}
+
+	if (psStatsReporterCount < PS_MAX_STATS_REPORTERS)
+	{
+		psStatsReporters[psStatsReporterCount] = reporter;
+		__atomic_store_n(&psStatsReporterCount, psStatsReporterCount + 1, __ATOMIC_RELEASE);
+	}
+	else
+	{
+		ERRORPRINT("psRegisterStatsReporter: too many reporters\n");
+		reply = -1;
+	}
+
+	s = pthread_mutex_unlock(&statsMtx);
+	if (s != 0)
+	{
+		ERRORPRINT("psRegisterStatsReporter: mutex unlock %i\n", s);
+	}
+	//end critical section
+
+	return reply;
+}
+
+//periodic file and GEN_STATS
+void *BrokerStatsThread(void *arg)
+{
+	char *statsFile = LOGFILE_FOLDER "/broker.stats";
+	char *tempFile = LOGFILE_FOLDER "/broker.stats.tmp";
+	int i;
+
+	while (1)
+	{
+		sleep(PS_STATS_PERIOD);
+
+		//write aside and rename, so readers never see a partial file
+		FILE *f = fopen(tempFile, "w");
+		if (f) PrintBrokerStats(f);
+
+		//reporters publish even without the file
+		int count = __atomic_load_n(&psStatsReporterCount, __ATOMIC_ACQUIRE);
+		for (i=0; i<count; i++)
+		{
+			(psStatsReporters[i])(f);
+		}
+
+		if (f)
+		{
+			fclose(f);
+			if (rename(tempFile, statsFile) != 0)
+			{
+				ERRORPRINT("stats: rename %s\n", strerror(errno));
+			}
+		}
+
+		count = __atomic_load_n(&psStatsQueueCount, __ATOMIC_ACQUIRE);
+		for (i=0; i<count; i++)
+		{
+			PublishQueueStats(&psStatsQueues[i]);
+		}
+	}
+	return 0;
+}
+
+//changes since the last publish - mean wait, current and high-water backlog, and losses
+void PublishQueueStats(psStatsQueue_t *sq)
+{
+	BrokerQueueStats_t now;
+	BrokerQueueStats(sq->queue, &now);
+
+	uint32_t taken = now.dequeued - sq->last.dequeued;
+	uint64_t waitNs = now.waitNs - sq->last.waitNs;
+	uint32_t lost = (now.dropped - sq->last.dropped) + (now.overflows - sq->last.overflows);
+
+	PublishStat(sq->name, "wait", (taken ? (int)(waitNs / taken / 1000) : 0));	//uS
+	PublishStat(sq->name, "depth", now.pending);
+	PublishStat(sq->name, "hwm", now.depthHWM);
+	if (lost) PublishStat(sq->name, "lost", lost);
+
+	sq->last = now;
+}
+
+void PublishStat(char *name, char *stat, int value)
+{
+	psMessage_t msg;
+
+	psInitPublish(msg, GEN_STATS);
+	snprintf(msg.nameIntPayload.name, PS_NAME_LENGTH, "%s %s", name, stat);
+	msg.nameIntPayload.value = value;
+	NewBrokerMessage(&msg);
+}
+
+//full report - queues, message types and the entry pool
+void PrintBrokerStats(FILE *f)
+{
+	BrokerQueueStats_t qs;
+	BrokerPoolStats_t ps;
+	int i;
+
+	fprintf(f, "%-12s %8s %10s %10s %8s %9s %9s %6s %10s\n",
+			"queue", "pending", "enqueued", "dequeued", "dropped", "coalesced", "overflows", "hwm", "wait uS");
+
+	int count = __atomic_load_n(&psStatsQueueCount, __ATOMIC_ACQUIRE);
+	for (i=0; i<count; i++)
+	{
+		BrokerQueueStats(psStatsQueues[i].queue, &qs);
+		fprintf(f, "%-12s %8u %10u %10u %8u %9u %9u %6u %10.1f\n",
+				psStatsQueues[i].name, qs.pending, qs.enqueued, qs.dequeued,
+				qs.dropped, qs.coalesced, qs.overflows, qs.depthHWM,
+				(qs.dequeued ? qs.waitNs / 1000.0 / qs.dequeued : 0.0));
+	}
+
+	fprintf(f, "\n%-20s %10s %10s %8s %10s\n", "message", "enqueued", "dequeued", "dropped", "wait uS");
+	for (i=0; i<=PS_MSG_COUNT; i++)
+	{
+		BrokerTypeStats_t *ts = &brokerTypeStats[i];
+		uint32_t enqueued = __atomic_load_n(&ts->enqueued, __ATOMIC_RELAXED);
+		uint32_t dequeued = __atomic_load_n(&ts->dequeued, __ATOMIC_RELAXED);
+		uint64_t waitNs = __atomic_load_n(&ts->waitNs, __ATOMIC_RELAXED);
+
+		uint32_t dropped = __atomic_load_n(&ts->dropped, __ATOMIC_RELAXED);
+
+		if (enqueued == 0 && dropped == 0) continue;
+
+		fprintf(f, "%-20s %10u %10u %8u %10.1f\n",
+				(i < PS_MSG_COUNT ? psLongMsgNames[i] : "(unknown)"),
+				enqueued, dequeued, dropped,
+				(dequeued ? waitNs / 1000.0 / dequeued : 0.0));
+	}
+
+	BrokerPoolStats(&ps);
+	fprintf(f, "\npool: %u allocated in %u slabs, %u in use (hwm %u), %u refills, %u flushes, %u cap hits\n",
+			ps.allocated, ps.slabs, ps.inUse, ps.inUseHWM, ps.refills, ps.flushes, ps.capHits);
+}
@@ -0,0 +1,228 @@
+/*
+ * brokerTap.c
+ *
+ * Filtered subscriptions (taps) - attached and removed at run time
+ *
+ * A tap names a set of message types, optionally a source subsystem and a predicate
+ * on the payload. The dispatchers only look at taps for a type that at least one tap
+ * wants, so with no taps attached routing costs one counter load per message.
+ *
+ *      Author: martin
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "PubSubData.h"
+#include "pubsub/pubsub.h"
+#include "syslog/syslog.h"
+#include "SoftwareProfile.h"
+
+#include "brokerQ.h"
+#include "broker_debug.h"
+
+typedef struct {
+	psFilter_t filter;
+	BrokerQueue_t *queue;			//zero-copy delivery, or
+	psHandler_t handler;			//called on the dispatcher thread
+	uint32_t active;
+	uint32_t users;					//dispatchers evaluating this tap
+	uint32_t matched;
+} psTap_t;
+
+psTap_t psTaps[PS_MAX_TAPS];
+int psTapHigh = 0;						//slots in use are below this
+uint32_t psTapTypeCount[PS_MSG_COUNT];	//taps wanting each type - read on the dispatch path
+pthread_mutex_t	tapMtx = PTHREAD_MUTEX_INITIALIZER;
+
+//filter building
+void psFilterInit(psFilter_t *f)
+{
+	memset(f, 0, sizeof(psFilter_t));
+	f->source = PS_ANY_SOURCE;
+}
+
+int psFilterType(psFilter_t *f, psMessageType_enum messageType)
+{
+	if (messageType < 0 || messageType >= PS_MSG_COUNT) return -1;
+	f->types[messageType] = 1;
+	return 0;
+}
+
+//every type whose default topic is 'topic'
+int psFilterTopic(psFilter_t *f, int topic)
+{
+	int i;
+	int reply = -1;
+
+	for (i=0; i<PS_MSG_COUNT; i++)
+	{
+		if (psDefaultTopics[i] == topic)
+		{
+			f->types[i] = 1;
+			reply = 0;
+		}
+	}
+	return reply;
+}
+
+void psFilterAllTypes(psFilter_t *f)
+{
+	memset(f->types, 1, sizeof(f->types));
+}
+
+//attach a tap delivering to a queue (zero-copy, as psSubscribeQueue) or to a handler
+//returns the tap id for psRemoveTap, -1 if no slot is free
+int psAddTap(const psFilter_t *filter, BrokerQueue_t *q, psHandler_t handler)
+{
+	int i, t;
+	int reply = -1;
+
+	if ((q == NULL) == (handler == NULL)) return -1;
+
+	//critical section
+	int s = pthread_mutex_lock(&tapMtx);
+	if (s != 0)
+	{
+		ERRORPRINT("psAddTap: mutex lock %i\n", s);
+	}
+
+	for (i=0; i<PS_MAX_TAPS; i++)
+	{
+		psTap_t *tap = &psTaps[i];
+
+		//free and no dispatcher still looking at it
+		if (__atomic_load_n(&tap->active, __ATOMIC_RELAXED) == 0
+				&& __atomic_load_n(&tap->users, __ATOMIC_ACQUIRE) == 0)
+		{
+			tap->filter = *filter;
+			tap->queue = q;
+			tap->handler = handler;
+			tap->matched = 0;
+			__atomic_store_n(&tap->active, 1, __ATOMIC_RELEASE);
+
+			if (i >= psTapHigh) __atomic_store_n(&psTapHigh, i + 1, __ATOMIC_RELEASE);
+
+			//published last - dispatchers start looking from here
+			for (t=0; t<PS_MSG_COUNT; t++)
+			{
+				if (filter->types[t]) __atomic_add_fetch(&psTapTypeCount[t], 1, __ATOMIC_RELEASE);
+			}
+			reply = i;
+			break;
+		}
+	}
+	if (reply < 0)
+	{
+		ERRORPRINT("psAddTap: all %i taps in use\n", PS_MAX_TAPS);
+	}
+
+	s = pthread_mutex_unlock(&tapMtx);
+	if (s != 0)
+	{
+		ERRORPRINT("psAddTap: mutex unlock %i\n", s);
+	}
+	//end critical section
+
+	return reply;
+}
+
+//detach a tap. on return no dispatcher is still delivering to it
+//entries already on the tap's queue are the owner's to release
+int psRemoveTap(int id)
+{
+	int t;
+	int reply = 0;
+
+	if (id < 0 || id >= PS_MAX_TAPS) return -1;
+
+	psTap_t *tap = &psTaps[id];
+
+	//critical section
+	int s = pthread_mutex_lock(&tapMtx);
+	if (s != 0)
+	{
+		ERRORPRINT("psRemoveTap: mutex lock %i\n", s);
+	}
+
+	if (__atomic_load_n(&tap->active, __ATOMIC_RELAXED))
+	{
+		for (t=0; t<PS_MSG_COUNT; t++)
+		{
+			if (tap->filter.types[t]) __atomic_sub_fetch(&psTapTypeCount[t], 1, __ATOMIC_RELAXED);
+		}
+
+		//pairs with the users increment in RouteTaps
+		__atomic_store_n(&tap->active, 0, __ATOMIC_SEQ_CST);
+		while (__atomic_load_n(&tap->users, __ATOMIC_SEQ_CST) != 0)
+		{
+			sched_yield();
+		}
+		DEBUGPRINT("tap %i removed, %u matched\n", id, tap->matched);
+	}
+	else
+	{
+		reply = -1;
+	}
+
+	s = pthread_mutex_unlock(&tapMtx);
+	if (s != 0)
+	{
+		ERRORPRINT("psRemoveTap: mutex unlock %i\n", s);
+	}
+	//end critical section
+
+	return reply;
+}
+
+//messages delivered by a tap so far
+uint32_t psTapMatched(int id)
+{
+	if (id < 0 || id >= PS_MAX_TAPS) return 0;
+	return __atomic_load_n(&psTaps[id].matched, __ATOMIC_RELAXED);
+}
+
+//offer a routed entry to the taps - dispatcher threads, only when psTapTypeCount[type] is non-zero
+void RouteTaps(BrokerQueueEntry_t *e)
+{
+	psMessage_t *msg = &e->msg;
+	int type = msg->header.messageType;
+	int high = __atomic_load_n(&psTapHigh, __ATOMIC_ACQUIRE);
+	int i;
+
+	for (i=0; i<high; i++)
+	{
+		psTap_t *tap = &psTaps[i];
+
+		if (__atomic_load_n(&tap->active, __ATOMIC_RELAXED) == 0) continue;
+
+		//hold the tap while using it - psRemoveTap waits for this to drop
+		__atomic_add_fetch(&tap->users, 1, __ATOMIC_SEQ_CST);
+
+		if (__atomic_load_n(&tap->active, __ATOMIC_SEQ_CST)
+				&& tap->filter.types[type]
+				&& (tap->filter.source == PS_ANY_SOURCE || tap->filter.source == msg->header.source)
+				&& (tap->filter.predicate == NULL || (tap->filter.predicate)(msg, tap->filter.arg)))
+		{
+			__atomic_add_fetch(&tap->matched, 1, __ATOMIC_RELAXED);
+
+			if (tap->queue)
+			{
+				RetainQueueEntry(e, 1);
+				AppendQueueEntry(tap->queue, e);
+			}
+			else
+			{
+				(tap->handler)(msg);
+			}
+		}
+
+		__atomic_sub_fetch(&tap->users, 1, __ATOMIC_RELEASE);
+	}
+}
@@ -14,4 +14,12 @@ extern FILE *psDebugFile;
 
 #define ERRORPRINT(...) fprintf(stdout, __VA_ARGS__);fprintf(psDebugFile, __VA_ARGS__);fflush(psDebugFile);
 
+//per-message trace - compiled out unless BROKER_TRACE, then gated at run time
+#ifdef BROKER_TRACE
+extern bool psTraceMessages;
+#define TRACEPRINT(...) if (psTraceMessages) {DEBUGPRINT(__VA_ARGS__)}
+#else
+#define TRACEPRINT(...)
+#endif
+
 #endif
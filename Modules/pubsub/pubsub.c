@@ -23,11 +23,6 @@ gd Name        : Broker.c
 #include "PubSubData.h"
 #include "Helpers.h"
 #include "pubsub/pubsub.h"
-#include "blackboard/blackboard.h"
-#include "behavior/behavior.h"
-#include "navigator/navigator.h"
-#include "scanner/scanner.h"
-#include "autopilot/autopilot.h"
 #include "syslog/syslog.h"
 #include "SoftwareProfile.h"
 
@@ -38,118 +33,178 @@ FILE *psDebugFile;
 
 bool PubSubBrokerReady = false;
 
-//broker structures
-//input queue
-BrokerQueue_t brokerQueue = BROKER_Q_INITIALIZER;
+#ifdef BROKER_TRACE
+bool psTraceMessages = false;
+#endif
+
+//subscription registry - lists of handlers and zero-copy queues per message type
+typedef struct {
+	int count;
+	psHandler_t handler[PS_MAX_SUBSCRIBERS];
+	int queueCount;
+	BrokerQueue_t *queue[PS_MAX_SUBSCRIBERS];
+} psSubscriberList_t;
 
-void *BrokerInputThread(void *args);
+psSubscriberList_t psSubscribers[PS_MSG_COUNT];
+pthread_mutex_t	subscribeMtx = PTHREAD_MUTEX_INITIALIZER;
 
 pthread_t PubSubInit()
 {
-	int reply;
-	pthread_t inputThread;
-
 	psDebugFile = fopen("/root/logfiles/broker.log", "w");
 
-	//create thread to receive messages from the broker pipe/queue
-	int s = pthread_create(&inputThread, NULL, BrokerInputThread, NULL);
-	if (s != 0)
+	BrokerStatsInit();
+
+	//routing threads - topics are shared out between them
+	return BrokerDispatchInit();
+}
+
+//the one ingress check - type range and payload length
+//returns -1 if the message cannot be routed
+int psValidateMessage(psMessage_t *msg)
+{
+	if (msg->header.messageType < 0 || msg->header.messageType >= PS_MSG_COUNT)
 	{
-		ERRORPRINT("input pthread_create\n");
-		return s;
+		ERRORPRINT("Broker: bad message type %i\n", msg->header.messageType);
+		return -1;
 	}
-	return s;
+	AdjustMessageLength(msg);
+	return 0;
+}
+
+//publish - historic name for NewBrokerMessage
+//routed later by the topic's dispatcher, not on the caller's thread
+void RouteMessage(psMessage_t *msg)
+{
+	NewBrokerMessage(msg);
 }
 
-//processes messages from the broker queue
-void *BrokerInputThread(void *args)
+//pass a message already held in a queue entry to the subscribers - dispatcher threads only
+//zero-copy subscribers share the entry itself. the entry must have been through psValidateMessage
+//and the caller keeps its own reference
+void RouteQueueEntry(BrokerQueueEntry_t *e)
 {
-	PubSubBrokerReady = true;
+	int i;
+	psMessage_t *msg = &e->msg;
+
+	e->queued = 0;		//restamped by the next hop
+
+	psSubscriberList_t *list = &psSubscribers[msg->header.messageType];
+	int count = __atomic_load_n(&list->count, __ATOMIC_ACQUIRE);
+
+	for (i=0; i<count; i++)
+	{
+		(list->handler[i])(msg);
+	}
+
+	//zero-copy fan-out: one envelope, one reference per queue
+	count = __atomic_load_n(&list->queueCount, __ATOMIC_ACQUIRE);
+	if (count > 0)
+	{
+		RetainQueueEntry(e, count);
+		for (i=0; i<count; i++)
+		{
+			AppendQueueEntry(list->queue[i], e);
+		}
+	}
+
+	//filters are only evaluated for types a tap wants
+	if (__atomic_load_n(&psTapTypeCount[msg->header.messageType], __ATOMIC_ACQUIRE))
+	{
+		RouteTaps(e);
+	}
+}
+
+//add a handler for one message type
+//called during init, but safe against concurrent routing: the handler is stored before the count is published
+int psSubscribe(psMessageType_enum messageType, psHandler_t handler)
+{
+	int reply = 0;
+
+	if (messageType < 0 || messageType >= PS_MSG_COUNT) return -1;
+
+	psSubscriberList_t *list = &psSubscribers[messageType];
+
+	//critical section
+	int s = pthread_mutex_lock(&subscribeMtx);
+	if (s != 0)
+	{
+		ERRORPRINT("psSubscribe: mutex lock %i\n", s);
+	}
+
+	if (list->count < PS_MAX_SUBSCRIBERS)
+	{
+		list->handler[list->count] = handler;
+		__atomic_store_n(&list->count, list->count + 1, __ATOMIC_RELEASE);
+	}
+	else
+	{
+		ERRORPRINT("psSubscribe: too many subscribers to %s\n", psLongMsgNames[messageType]);
+		reply = -1;
+	}
 
-	while(1)
+	s = pthread_mutex_unlock(&subscribeMtx);
+	if (s != 0)
 	{
-		//process messages off the broker queue
-		psMessage_t *msg = GetNextMessage(&brokerQueue);
+		ERRORPRINT("psSubscribe: mutex unlock %i\n", s);
+	}
+	//end critical section
+
+	return reply;
+}
 
-		AdjustMessageLength(msg);
+//add a zero-copy queue for one message type
+//the queue receives a shared, reference-counted entry - the consumer must treat the message as read-only
+//and release it with DoneWithMessage
+int psSubscribeQueue(psMessageType_enum messageType, BrokerQueue_t *q)
+{
+	int reply = 0;
 
-		if (msg->header.messageType != SYSLOG_MSG &&
-				msg->header.messageType != BBBLOG_MSG)
-			DEBUGPRINT("Broker: %s\n", psLongMsgNames[msg->header.messageType]);
+	if (messageType < 0 || messageType >= PS_MSG_COUNT) return -1;
 
-		RouteMessage(msg);
+	psSubscriberList_t *list = &psSubscribers[messageType];
 
-		DoneWithMessage(msg);
+	//critical section
+	int s = pthread_mutex_lock(&subscribeMtx);
+	if (s != 0)
+	{
+		ERRORPRINT("psSubscribeQueue: mutex lock %i\n", s);
 	}
+
+	if (list->queueCount < PS_MAX_SUBSCRIBERS)
+	{
+		list->queue[list->queueCount] = q;
+		__atomic_store_n(&list->queueCount, list->queueCount + 1, __ATOMIC_RELEASE);
+	}
+	else
+	{
+		ERRORPRINT("psSubscribeQueue: too many subscribers to %s\n", psLongMsgNames[messageType]);
+		reply = -1;
+	}
+
+	s = pthread_mutex_unlock(&subscribeMtx);
+	if (s != 0)
+	{
+		ERRORPRINT("psSubscribeQueue: mutex unlock %i\n", s);
+	}
+	//end critical section
+
+	return reply;
 }
 
-//pass message to appropriate modules
-void RouteMessage(psMessage_t *msg)
+//add a handler for all message types with this default topic
+int psSubscribeTopic(int topic, psHandler_t handler)
 {
-	AdjustMessageLength(msg);
+	int i;
+	int reply = 0;
 
-	switch(psDefaultTopics[msg->header.messageType])
-	{
-	default:
-		break;
-	case LOG_TOPIC:              //SysLog
-		LogProcessMessage(msg);
-		SerialBrokerProcessMessage(msg);
-		break;
-	case OVM_LOG_TOPIC:
-		LogProcessMessage(msg);
-		break;
-	case ANNOUNCEMENTS_TOPIC:    //Common channel
-		AutopilotProcessMessage(msg);
-		BlackboardProcessMessage(msg);
-		ResponderProcessMessage(msg);
-		BehaviorProcessMessage(msg);
-		SerialBrokerProcessMessage(msg);
-		break;
-	case CONFIG_TOPIC:           //To send config data to APP/BBB
-	case STATS_TOPIC:            //To send stats to APP
-	case MOT_ACTION_TOPIC:
-		SerialBrokerProcessMessage(msg);
-		break;
-	case NAV_REPORT_TOPIC:       //Fused Odometry & Prox Reports
-		AutopilotProcessMessage(msg);
-		BehaviorProcessMessage(msg);
-		BlackboardProcessMessage(msg);
-		break;
-	case SYS_REPORT_TOPIC:       //Reports to APP
-		BlackboardProcessMessage(msg);
-		SerialBrokerProcessMessage(msg);
-		break;
-	case RAW_NAV_TOPIC:          //Raw compass & GPS
-	case NAV_ACTION_TOPIC:       //Navigator action
-		NavigatorProcessMessage(msg);
-		BlackboardProcessMessage(msg);
-		break;
-	case RAW_ODO_TOPIC:          //Raw Odometry
-		AutopilotProcessMessage(msg);
-		NavigatorProcessMessage(msg);
-		BlackboardProcessMessage(msg);
-		break;
-	case RAW_PROX_TOPIC:	    //Raw Prox reports
-#ifdef SCANNER
-		ScannerProcessMessage(msg);
-#endif
-		BlackboardProcessMessage(msg);
-		break;
-	case ACTION_TOPIC:
-		AutopilotProcessMessage(msg);
-#ifdef SCANNER
-		ScannerProcessMessage(msg);
-#endif
-		BlackboardProcessMessage(msg);
-		break;
-	case TICK_1S_TOPIC:          //1 second ticks
-		AutopilotProcessMessage(msg);
-		NavigatorProcessMessage(msg);
-		BlackboardProcessMessage(msg);
-		BehaviorProcessMessage(msg);
-		break;
+	for (i=0; i<PS_MSG_COUNT; i++)
+	{
+		if (psDefaultTopics[i] == topic)
+		{
+			if (psSubscribe(i, handler) < 0) reply = -1;
+		}
 	}
+	return reply;
 }
 
 //notifications
@@ -167,8 +222,7 @@ void Notify(Notification_enum e)
 		qe->msg.header.messageType = NOTIFICATION;
 		qe->msg.header.source = OVERMIND;
 		qe->msg.intPayload.value = e;
-		AdjustMessageLength(&qe->msg);
-		AppendQueueEntry(&brokerQueue, qe);
+		NewBrokerEntry(qe);
 	}
 	else
 	{
@@ -190,8 +244,7 @@ void CancelNotification(Notification_enum e)
 		qe->msg.header.messageType = NOTIFICATION;
 		qe->msg.header.source = OVERMIND;
 		qe->msg.intPayload.value = -e;
-		AdjustMessageLength(&qe->msg);
-		AppendQueueEntry(&brokerQueue, qe);
+		NewBrokerEntry(qe);
 	}
 	else
 	{
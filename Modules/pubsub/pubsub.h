@@ -12,6 +12,8 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
+#include <pthread.h>
 
 #include "PubSubData.h"
 #include "pubsub/brokerQ.h"
@@ -27,14 +29,81 @@ extern bool PubSubBrokerReady;
     msg.header.source=OVERMIND;\
         msg.header.length=psMessageFormatLengths[psMsgFormats[msgType]];}
 
-//main queue for the publishing broker
-extern BrokerQueue_t brokerQueue;
+//publish - validates, copies and queues for the dispatcher that owns the message's default topic
+//returns -1 if the message is bad or cannot be queued
+int NewBrokerMessage(psMessage_t *msg);
+int NewBrokerEntry(BrokerQueueEntry_t *e);				//publish an allocated entry - the reference passes to the broker
 
-//send a message to the broker
-#define NewBrokerMessage(msg) CopyMessageToQ(&brokerQueue, msg)
+void RouteMessage(psMessage_t *msg);					//historic name for NewBrokerMessage
+void RouteQueueEntry(BrokerQueueEntry_t *e);			//already validated - routes on the calling (dispatcher) thread
 
-//route message directly
-void RouteMessage(psMessage_t *msg);
+int psValidateMessage(psMessage_t *msg);				//type range check and length normalization, -1 if bad
+
+//dispatcher pool (brokerDispatch.c)
+//each topic is routed by one dispatcher thread, so its messages arrive in publish order
+//default pool size is PS_DISPATCHERS (SoftwareProfile.h), with topic n on dispatcher n % count
+#define PS_MAX_DISPATCHERS		8
+
+//set up before the first publish
+int psSetDispatchers(int count, const int cpus[]);		//pool size, CPU per dispatcher (-1 any, NULL = default)
+int psSetTopicDispatcher(int topic, int dispatcher);	//route a topic on a chosen dispatcher
+void psSetDispatchPolicy(int maxDepth, BrokerQueuePolicy_enum policy);	//every dispatcher queue
+
+int BrokerDispatchInit();								//start the dispatchers (PubSubInit)
+
+//subscriptions
+//handlers are called on the topic's dispatcher thread - typically copy to a module queue and return
+//a handler subscribed to several topics may be called concurrently
+typedef void (*psHandler_t)(psMessage_t *msg);
+
+#define PS_MAX_SUBSCRIBERS	8		//per message type
+
+int psSubscribe(psMessageType_enum messageType, psHandler_t handler);	//one message type
+int psSubscribeTopic(int topic, psHandler_t handler);					//every type whose default topic is 'topic'
+
+//zero-copy subscription - one shared entry is appended to the queue instead of a copy
+//messages taken from the queue are read-only, release them with DoneWithMessage
+int psSubscribeQueue(psMessageType_enum messageType, BrokerQueue_t *q);
+
+//taps - filtered subscriptions attached at run time (brokerTap.c)
+//a message is delivered if its type is in the set, it comes from 'source' and the predicate passes
+//e.g. POSE with a valid fix: psFilterType(&f, POSE); f.predicate = PoseValid;
+#define PS_MAX_TAPS			8
+#define PS_ANY_SOURCE		-1
+
+typedef bool (*psPredicate_t)(psMessage_t *msg, void *arg);	//called on the dispatcher thread
+
+typedef struct {
+	uint8_t types[PS_MSG_COUNT];	//non-zero = wanted
+	int source;						//header.source, PS_ANY_SOURCE = any
+	psPredicate_t predicate;		//NULL = no payload test
+	void *arg;						//passed to the predicate
+} psFilter_t;
+
+void psFilterInit(psFilter_t *f);							//no types, any source, no predicate
+int psFilterType(psFilter_t *f, psMessageType_enum messageType);
+int psFilterTopic(psFilter_t *f, int topic);				//every type with this default topic
+void psFilterAllTypes(psFilter_t *f);
+
+int psAddTap(const psFilter_t *filter, BrokerQueue_t *q, psHandler_t handler);	//queue (zero-copy) or handler. returns id, -1 if none free
+int psRemoveTap(int id);									//no further deliveries once it returns
+uint32_t psTapMatched(int id);								//messages delivered so far
+
+void RouteTaps(BrokerQueueEntry_t *e);						//dispatch path
+extern uint32_t psTapTypeCount[PS_MSG_COUNT];				//taps wanting each type
+
+//broker statistics (brokerStats.c)
+#define PS_STATS_PERIOD			10		//seconds between stats file updates and GEN_STATS
+#define PS_MAX_STATS_QUEUES		16
+#define PS_MAX_STATS_REPORTERS	4
+
+typedef void (*psStatsReporter_t)(FILE *f);				//f is the stats file, NULL if it could not be opened
+
+int psRegisterQueueStats(BrokerQueue_t *q, char *name);	//report this queue by name
+int psRegisterStatsReporter(psStatsReporter_t reporter);	//called each period - prints to f, publishes with PublishStat
+void PublishStat(char *name, char *stat, int value);		//one GEN_STATS, named "name stat"
+void PrintBrokerStats(FILE *f);							//queues, message types and pool
+pthread_t BrokerStatsInit();
 
 //NBotifications
 void Notify(Notification_enum e);
@@ -48,6 +117,7 @@ pthread_t ResponderInit();
 pthread_t SerialBrokerInit();
 
 void SerialBrokerProcessMessage(psMessage_t *msg);	//consider candidate msg to send over the uart
+int SerialBrokerBudget(int topic, int rate, int burst);	//topic share of the uart - bytes/sec (0 = unlimited), burst bytes
 
 //responder
 void ResponderProcessMessage(psMessage_t *msg);
@@ -36,6 +36,10 @@ int startFlag = 1;
 
 pthread_t ResponderInit()
 {
+	psSubscribeQueue(CONFIG, &responderQueue);
+	psSubscribeQueue(PING_MSG, &responderQueue);
+	psRegisterQueueStats(&responderQueue, "responder");
+
 	pthread_t thread;
 	int s = pthread_create(&thread, NULL, ResponderMessageThread, NULL);
 	if (s != 0)
@@ -6,6 +6,8 @@
  */
 
 //Forwards PubSub messages via UART to PIC
+//With PS_UART_RELIABLE urgent (first QOS) messages are ACKed and retransmitted, and with
+//PS_UART_COMPACT the PIC's odometry and IMU reports are delta coded - both ends must be built with them
 
 #include <stdint.h>
 #include <stdbool.h>
@@ -14,6 +16,7 @@
 #include <stdio.h>
 
 #include <unistd.h>
+#include <time.h>
 #include <termios.h>
 #include <fcntl.h>
 #include <errno.h>
@@ -24,18 +27,17 @@
 #include "common.h"
 #include "PubSubData.h"
 #include "PubSubParser.h"
+#include "pubsub/pubsub.h"
 #include "blackboard/blackboard.h"
 #include "syslog/syslog.h"
 #include "SoftwareProfile.h"
 #include "brokerQ.h"
+#include "wireCodec.h"
 #include "broker_debug.h"
 
 
 //Serial Tx queue
-BrokerQueue_t uartTxQueue = {NULL, NULL,
-		PTHREAD_MUTEX_INITIALIZER,
-		PTHREAD_COND_INITIALIZER
-};
+BrokerQueue_t uartTxQueue = BROKER_Q_INITIALIZER;
 
 //RX and TX UART threads
 void *RxThread(void *a);
@@ -44,16 +46,146 @@ void *TxThread(void *a);
 #define MAX_UART_MESSAGE (sizeof(psMessage_t) + 10)
 
 int picUartFD;
+UartReader_t picUartReader;		//RX buffer
+
+//link health - published each stats period by SerialLinkStats. TX queue wait is the uartTx queue's own
+typedef struct {
+	uint32_t rxFrames, rxBytes;
+	uint32_t rxChecksum;			//frames failing the checksum
+	uint32_t rxLength;				//length and ~length disagree, or too long
+	uint32_t rxGaps;				//telemetry frames missing by sequence number
+	uint32_t rxSkipped;				//bytes skipped looking for a frame start
+	uint32_t txFrames, txBytes;
+	uint32_t writeErrors;
+	uint32_t writes;
+	uint64_t writeNs;				//blocked in write()
+	uint64_t writeMaxNs;			//longest since the last report
+} UartLinkStats_t;
+
+UartLinkStats_t uartLink;
+
+//RX frame tracker - follows the framing alongside the parser, which resyncs silently, to count
+//what it throws away. also keeps the sequence number, which the parser does not return
+typedef enum {TRACK_STX, TRACK_LENGTH, TRACK_LENGTH2, TRACK_BODY} TrackState_enum;
+
+typedef struct {
+	TrackState_enum state;
+	uint8_t length;
+	uint8_t sum;
+	int remaining;					//body bytes to come, checksum last
+	int index;
+	uint8_t header[3];				//sequence, source, type
+	uint8_t sequence;				//of the last good frame
+	uint8_t last;					//of the last good telemetry frame
+	bool synced;
+} RxTracker_t;
+
+RxTracker_t rxTracker;				//RX thread
+
+//TX budgets - generic cell rate: each byte costs 1/rate seconds, and a message is in budget
+//if its cost fits before the theoretical arrival time runs 'burst' bytes ahead of now
+typedef struct {
+	uint32_t rate;					//bytes/sec, 0 = unlimited
+	uint32_t burst;					//bytes
+	uint64_t tat;					//theoretical arrival time, CLOCK_MONOTONIC nS
+	uint32_t dropped;
+} TxBudget_t;
+
+//one per topic - a topic is routed by one dispatcher, so each budget has one writer
+TxBudget_t topicBudget[PS_TOPIC_COUNT];
+
+//the link itself - TX thread only
+TxBudget_t linkBudget = {PS_UART_TX_RATE, PS_UART_TX_BURST, 0, 0};
+
+//one writer at a time - the RX thread sends ACKs between TX chunks
+pthread_mutex_t	uartWriteMtx = PTHREAD_MUTEX_INITIALIZER;
+
+#ifdef PS_UART_RELIABLE
+//Reliable channel - urgent messages are numbered in their own sequence space (top bit of the
+//frame sequence number set), held until ACKed and retransmitted on timeout. Telemetry keeps its
+//unacknowledged path; its sequence numbers just lose the top bit.
+//An ACK is a link frame of type PS_LINK_ACK, never routed - the next sequence number expected
+//and a bitmap of the 32 after it already received (selective repeat)
+#define RELIABLE_FLAG		0x80
+#define RELIABLE_SPACE		128				//sequence numbers - more than twice the window
+#define RELIABLE_MASK		(RELIABLE_SPACE - 1)
+#define RELIABLE_HOLD		32				//urgent messages waiting for the window
+#define RELIABLE_ACK_POLL	5				//mS - TX looks for ACKs this often with frames in flight
+#define RELIABLE_RESYNC		8				//consecutive stale frames before RX assumes the PIC restarted
+#define PS_LINK_ACK			0xff
+#define ACK_LENGTH			5
+
+#if PS_UART_WINDOW > 32
+#error "PS_UART_WINDOW must fit the ACK bitmap"
+#endif
+
+#define MS_NS(m)	((uint64_t)(m) * 1000000ULL)
+
+typedef struct {
+	psMessage_t *msg;				//retained queue entry, NULL once ACKed or abandoned
+	uint64_t sent;					//last transmission, nS
+	int retries;
+} ReliableSlot_t;
+
+//TX side - the TX thread owns it, the RX thread reads base/next and marks ACKs
+typedef struct {
+	ReliableSlot_t slot[RELIABLE_SPACE];
+	uint32_t base;					//oldest in flight - free running, slot is & RELIABLE_MASK
+	uint32_t next;					//next to send
+	psMessage_t *held[RELIABLE_HOLD];
+	int heldHead, heldCount;
+	uint32_t acked[RELIABLE_SPACE / 32];	//set by RX
+	uint64_t ackTime[RELIABLE_SPACE];		//when the ACK arrived
+	uint64_t srtt, rttvar, rto;				//nS
+	uint32_t sent, retransmits, abandoned, overflows;
+} ReliableTx_t;
+
+ReliableTx_t reliableTx = {.rto = MS_NS(PS_UART_RTO_INIT)};
+
+//RX side - RX thread only
+typedef struct {
+	bool synced;
+	uint8_t next;					//next sequence number expected
+	uint32_t seen[RELIABLE_SPACE / 32];
+	int stale;
+	uint32_t received, duplicates;
+} ReliableRx_t;
+
+ReliableRx_t reliableRx;
+
+#define BEST_EFFORT_SEQ		(~RELIABLE_FLAG & 0xff)
+
+#define BIT_TEST(map, n)	((map)[(n) >> 5] & (1u << ((n) & 31)))
+#define BIT_SET(map, n)		((map)[(n) >> 5] |= (1u << ((n) & 31)))
+#define BIT_CLEAR(map, n)	((map)[(n) >> 5] &= ~(1u << ((n) & 31)))
+#else
+#define BEST_EFFORT_SEQ		0xff
+#endif
+
+#ifdef PS_UART_COMPACT
+psWireCodec_t txCodec;				//TX thread
+psWireCodec_t rxCodec;				//RX thread
+#endif
+
+static void SerialLinkStats(FILE *f);
+
+//charge 'bytes' to a budget. false if over budget (nothing charged)
+static bool ChargeBudget(TxBudget_t *b, int bytes, uint64_t now)
+{
+	if (b->rate == 0) return true;
+
+	uint64_t cost = (uint64_t) bytes * 1000000000ULL / b->rate;
+	uint64_t tolerance = (uint64_t) b->burst * 1000000000ULL / b->rate;
+	uint64_t tat = (b->tat > now ? b->tat : now);
 
-int routineCount;
-int infoCount;
-int warningCount;
-int errorCount;
+	if (tat + cost > now + tolerance) return false;
+
+	b->tat = tat + cost;
+	return true;
+}
 
 pthread_t SerialBrokerInit()
 {
-	struct termios settings;
-
 	if (uart_setup(PS_TX_PIN, PS_RX_PIN) < 0)
 	{
 		return -1;
@@ -71,32 +203,40 @@ pthread_t SerialBrokerInit()
 		DEBUGPRINT("%s opened", PS_UART_DEVICE);
 	}
 
-	if (tcgetattr(picUartFD, &settings) != 0) {
-		ERRORPRINT("tcgetattr failed: %s\n", strerror(errno));
-		return -1;
-	}
-
-	//no processing
-	settings.c_iflag = 0;
-	settings.c_oflag = 0;
-	settings.c_lflag = 0;
-	settings.c_cflag = CLOCAL | CREAD | CS8;        //no modem, 8-bits
-
-	//baudrate
-	cfsetospeed(&settings, PS_UART_BAUDRATE);
-	cfsetispeed(&settings, PS_UART_BAUDRATE);
-
-	if (tcsetattr(picUartFD, TCSANOW, &settings) != 0) {
-		ERRORPRINT("tcsetattr failed: %s\n", strerror(errno));
+	//a read() waits for at least a minimum frame
+	if (uart_configure(picUartFD, PS_UART_BAUDRATE, PS_UART_VMIN, PS_UART_VTIME) < 0) {
+		ERRORPRINT("uart configure failed\n");
 		return -1;
 	}
 
 	DEBUGPRINT("uart configured\n");
 
-	routineCount = 0;
-	infoCount = 0;
-	warningCount = 0;
-	errorCount = 0;
+	//link paced by the TX thread - the backlog waits here, urgent lane first, rather than in the driver
+	//stale telemetry is trimmed oldest first. motor commands in the urgent lane are refused and counted, never trimmed
+	SetQueuePolicy(&uartTxQueue, PS_UART_TX_DEPTH, BROKER_Q_DROP_OLDEST);
+	psRegisterQueueStats(&uartTxQueue, "uartTx");
+	psRegisterStatsReporter(SerialLinkStats);
+
+	//telemetry budgets - commands and config are only paced by the link
+	SerialBrokerBudget(LOG_TOPIC, PS_UART_LOG_RATE, PS_UART_LOG_BURST);
+	SerialBrokerBudget(STATS_TOPIC, PS_UART_STATS_RATE, PS_UART_STATS_BURST);
+	SerialBrokerBudget(SYS_REPORT_TOPIC, PS_UART_REPORT_RATE, PS_UART_REPORT_BURST);
+
+#ifdef PS_UART_COMPACT
+	//delta coded telemetry - raw nav from the PIC. no forwarded type is coded, so TX frames go whole
+	psWireCodecInit(&txCodec);
+	psWireCodecInit(&rxCodec);
+	psWireCompact(ODOMETRY);
+	psWireCompact(IMU_REPORT);
+#endif
+
+	//topics forwarded to the PIC
+	psSubscribeTopic(LOG_TOPIC, SerialBrokerProcessMessage);
+	psSubscribeTopic(ANNOUNCEMENTS_TOPIC, SerialBrokerProcessMessage);
+	psSubscribeTopic(CONFIG_TOPIC, SerialBrokerProcessMessage);
+	psSubscribeTopic(STATS_TOPIC, SerialBrokerProcessMessage);
+	psSubscribeTopic(MOT_ACTION_TOPIC, SerialBrokerProcessMessage);
+	psSubscribeTopic(SYS_REPORT_TOPIC, SerialBrokerProcessMessage);
 
 	//start RX & TX threads
 	pthread_t thread;
@@ -117,117 +257,687 @@ pthread_t SerialBrokerInit()
 	return s;
 }
 
+//set a topic's share of the link - bytes/sec (0 = unlimited) and burst bytes
+//call before the topic is routed
+int SerialBrokerBudget(int topic, int rate, int burst)
+{
+	if (topic < 0 || topic >= PS_TOPIC_COUNT || rate < 0 || burst < 0) return -1;
+
+	topicBudget[topic].rate = rate;
+	topicBudget[topic].burst = burst;
+	topicBudget[topic].tat = 0;
+	return 0;
+}
+
 //called by the broker to see whether a message should be queued for the TX Thread
 
 void SerialBrokerProcessMessage(psMessage_t *msg)
 {
 	if (msg->header.source != OVERMIND) return;
 
-	DEBUGPRINT("Serial: %s\n", psLongMsgNames[msg->header.messageType]);
+	int type = msg->header.messageType;
+	int topic = psDefaultTopics[type];
+
+	TRACEPRINT("Serial: %s\n", psLongMsgNames[type]);
 
-	//check for messages to send to MCP
-	switch(psDefaultTopics[msg->header.messageType])
+	//only errors and failures are reported to the PIC
+	if (topic == LOG_TOPIC && msg->logPayload.severity < SYSLOG_ERROR) return;
+
+	//telemetry over its topic budget is dropped here - urgent (lane 0) messages never are
+	if (psQOS[type] > 0 && (unsigned) topic < PS_TOPIC_COUNT)
 	{
-	case LOG_TOPIC:              //SysLog
+		TxBudget_t *b = &topicBudget[topic];
+		if (!ChargeBudget(b, msg->header.length + 7, BrokerNow()))
+		{
+			__atomic_add_fetch(&brokerTypeStats[type].dropped, 1, __ATOMIC_RELAXED);
+			uint32_t n = __atomic_add_fetch(&b->dropped, 1, __ATOMIC_RELAXED);
+			if ((n & (n - 1)) == 0)
+			{
+				//report 1st, 2nd, 4th, 8th... drop
+				ERRORPRINT("uart: %s over budget, %u dropped\n", psTopicNames[topic], n);
+			}
+			return;
+		}
+	}
+
+	//add to transmit queue
+	CopyMessageToQ(&uartTxQueue, msg);
+	TRACEPRINT("uart: Queuing for send: %s\n", psLongMsgNames[type]);
+}
+
+//sum of n bytes modulo 256, a word at a time - the frame checksum
+//each 16 bit lane takes two bytes per word, so cannot overflow below 512 bytes
+static inline uint8_t FrameChecksum(const uint8_t *p, int n)
+{
+	uint32_t lanes = 0;
+	uint32_t sum = 0;
+	uint32_t w;
+
+	while (n >= 4)
 	{
-		//decide whether to report this log message
-		int severity = msg->logPayload.severity;
-		switch (severity)
+		memcpy(&w, p, 4);		//unaligned - one load on the A8
+		lanes += (w & 0x00ff00ff) + ((w >> 8) & 0x00ff00ff);
+		p += 4;
+		n -= 4;
+	}
+	while (n-- > 0) sum += *p++;
+
+	return (uint8_t)(sum + (lanes & 0xffff) + (lanes >> 16));
+}
+
+//frame one message at 'buffer' - stx, header(5), payload, checksum
+//returns the end of the frame
+static uint8_t *FrameMessage(uint8_t *buffer, psMessage_t *msg, uint8_t sequenceNumber)
+{
+	int length = msg->header.length + 7;
+	uint8_t *current = buffer;
+
+	*current++ = STX_CHAR;
+	*current++ = msg->header.length;
+	*current++ = ~msg->header.length;
+	*current++ = sequenceNumber;
+	*current++ = msg->header.source;
+	*current++ = msg->header.messageType;
+
+	memcpy(current, msg->packet, msg->header.length);
+
+	buffer[length-1] = FrameChecksum(buffer + 1, length - 2);
+	return buffer + length;
+}
+
+//frame a telemetry message - delta coded when that comes out shorter
+static uint8_t *FrameTelemetry(uint8_t *buffer, psMessage_t *msg, uint8_t sequenceNumber)
+{
+#ifdef PS_UART_COMPACT
+	psMessage_t compact;
+	int length = psWireEncode(&txCodec, msg, compact.packet);
+
+	if (length > 0)
+	{
+		compact.header = msg->header;
+		compact.header.length = length;
+		compact.header.messageType |= PS_WIRE_COMPACT;
+		return FrameMessage(buffer, &compact, sequenceNumber);
+	}
+#endif
+	return FrameMessage(buffer, msg, sequenceNumber);
+}
+
+//write all of a buffer holding 'frames' frames - a blocking write can still be cut short by a signal
+//returns bytes written
+static long UartWrite(const uint8_t *buffer, int length, int frames)
+{
+	long written = 0;
+
+	//critical section
+	int s = pthread_mutex_lock(&uartWriteMtx);
+	if (s != 0)
+	{
+		ERRORPRINT("uart: write mutex lock %i\n", s);
+	}
+
+	uint64_t start = BrokerNow();
+
+	while (written < length)
+	{
+		long n = write(picUartFD, buffer + written, length - written);
+		if (n < 0)
 		{
-        case SYSLOG_ERROR:
-        case SYSLOG_FAILURE:
-			if (errorCount++ >= MAX_ERROR) return;
-			break;
-        default:
-        	return;
+			if (errno == EINTR) continue;
+			uartLink.writeErrors++;
+			ERRORPRINT("uart TX: Failed to write to uart. %s\n", strerror(errno));
 			break;
 		}
+		written += n;
 	}
-	CopyMessageToQ(&uartTxQueue, msg);
-	break;
-	default:
-		//add to transmit queue
-		CopyMessageToQ(&uartTxQueue, msg);
-		DEBUGPRINT("uart: Queuing for send: %s\n", psLongMsgNames[msg->header.messageType]);
-		break;
 
+	//writers are serialized here - the stats thread only reads
+	uint64_t stall = BrokerNow() - start;
+	uartLink.writes++;
+	uartLink.writeNs += stall;
+	if (stall > uartLink.writeMaxNs) uartLink.writeMaxNs = stall;
+	if (written == length) uartLink.txFrames += frames;
+	uartLink.txBytes += written;
+
+	s = pthread_mutex_unlock(&uartWriteMtx);
+	if (s != 0)
+	{
+		ERRORPRINT("uart: write mutex unlock %i\n", s);
+	}
+	//end critical section
+
+	return written;
+}
+
+#ifdef PS_UART_RELIABLE
+static inline bool ReliableType(int type)
+{
+	return ((unsigned) type < PS_MSG_COUNT && psQOS[type] == 0);
+}
+
+//retransmit timeout from the smoothed round trip (RFC 6298 gains)
+static void ReliableRtt(uint64_t sample)
+{
+	ReliableTx_t *t = &reliableTx;
+
+	if (t->srtt == 0)
+	{
+		t->srtt = sample;
+		t->rttvar = sample / 2;
+	}
+	else
+	{
+		uint64_t delta = (t->srtt > sample ? t->srtt - sample : sample - t->srtt);
+		t->rttvar = (3 * t->rttvar + delta) / 4;
+		t->srtt = (7 * t->srtt + sample) / 8;
+	}
+	t->rto = t->srtt + 4 * t->rttvar;
+	if (t->rto < MS_NS(PS_UART_RTO_MIN)) t->rto = MS_NS(PS_UART_RTO_MIN);
+	if (t->rto > MS_NS(PS_UART_RTO_MAX)) t->rto = MS_NS(PS_UART_RTO_MAX);
+}
+
+//when a frame is due again - the timeout doubles with each retry
+static inline uint64_t ReliableDue(ReliableSlot_t *slot)
+{
+	uint64_t rto = reliableTx.rto << slot->retries;
+	if (rto > MS_NS(PS_UART_RTO_MAX)) rto = MS_NS(PS_UART_RTO_MAX);
+	return slot->sent + rto;
+}
+
+//queue an urgent message for the window - TX thread
+static void ReliableHold(psMessage_t *msg)
+{
+	ReliableTx_t *t = &reliableTx;
+
+	if (t->heldCount >= RELIABLE_HOLD)
+	{
+		uint32_t n = ++t->overflows;
+		if ((n & (n - 1)) == 0)
+		{
+			ERRORPRINT("uart: reliable backlog full, %u dropped\n", n);
+		}
+		__atomic_add_fetch(&brokerTypeStats[msg->header.messageType].dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	RetainQueueEntry((BrokerQueueEntry_t *) msg, 1);
+	t->held[(t->heldHead + t->heldCount++) % RELIABLE_HOLD] = msg;
+}
+
+//release what the PIC has ACKed and slide the window - TX thread
+static void ReliableCollect()
+{
+	ReliableTx_t *t = &reliableTx;
+	uint32_t n;
+
+	for (n = t->base; n != t->next; n++)
+	{
+		int r = n & RELIABLE_MASK;
+		ReliableSlot_t *slot = &t->slot[r];
+
+		if (slot->msg == NULL) continue;
+		if ((__atomic_load_n(&t->acked[r >> 5], __ATOMIC_ACQUIRE) & (1u << (r & 31))) == 0) continue;
+
+		//Karn - a retransmitted frame's ACK could be for either copy
+		if (slot->retries == 0 && t->ackTime[r] > slot->sent) ReliableRtt(t->ackTime[r] - slot->sent);
+
+		DoneWithMessage(slot->msg);
+		slot->msg = NULL;
+	}
+
+	n = t->base;
+	while (n != t->next && t->slot[n & RELIABLE_MASK].msg == NULL) n++;
+	__atomic_store_n(&t->base, n, __ATOMIC_RELEASE);
+}
+
+//frame retransmissions due, then held messages while the window has room - TX thread
+//returns the end of the frames, counted in 'frames'
+static uint8_t *ReliableFrames(uint8_t *current, uint64_t now, int *frames)
+{
+	ReliableTx_t *t = &reliableTx;
+	uint32_t n;
+
+	for (n = t->base; n != t->next; n++)
+	{
+		ReliableSlot_t *slot = &t->slot[n & RELIABLE_MASK];
+
+		if (slot->msg == NULL || ReliableDue(slot) > now) continue;
+
+		if (slot->retries + 1 >= PS_UART_RETRIES)
+		{
+			t->abandoned++;
+			ERRORPRINT("uart TX: %s not ACKed after %i tries\n", psLongMsgNames[slot->msg->header.messageType], PS_UART_RETRIES);
+			__atomic_add_fetch(&brokerTypeStats[slot->msg->header.messageType].dropped, 1, __ATOMIC_RELAXED);
+			DoneWithMessage(slot->msg);
+			slot->msg = NULL;
+			continue;
+		}
+		current = FrameMessage(current, slot->msg, RELIABLE_FLAG | (n & RELIABLE_MASK));
+		(*frames)++;
+		slot->sent = now;
+		slot->retries++;
+		t->retransmits++;
+	}
+
+	while (t->heldCount > 0 && t->next - t->base < PS_UART_WINDOW)
+	{
+		int r = t->next & RELIABLE_MASK;
+		ReliableSlot_t *slot = &t->slot[r];
+
+		slot->msg = t->held[t->heldHead];
+		slot->sent = now;
+		slot->retries = 0;
+		t->heldHead = (t->heldHead + 1) % RELIABLE_HOLD;
+		t->heldCount--;
+
+		//a late ACK for this number's last use must not count
+		__atomic_and_fetch(&t->acked[r >> 5], ~(1u << (r & 31)), __ATOMIC_RELAXED);
+
+		current = FrameMessage(current, slot->msg, RELIABLE_FLAG | r);
+		(*frames)++;
+		__atomic_store_n(&t->next, t->next + 1, __ATOMIC_RELEASE);
+		t->sent++;
+	}
+
+	//abandoned frames may have freed the front of the window
+	n = t->base;
+	while (n != t->next && t->slot[n & RELIABLE_MASK].msg == NULL) n++;
+	__atomic_store_n(&t->base, n, __ATOMIC_RELEASE);
+
+	return current;
+}
+
+//how long the TX thread may wait for messages (-1 forever)
+static int ReliableTimeout(uint64_t now)
+{
+	ReliableTx_t *t = &reliableTx;
+	uint64_t due = UINT64_MAX;
+	uint32_t n;
+
+	if (t->base == t->next) return -1;
+
+	for (n = t->base; n != t->next; n++)
+	{
+		ReliableSlot_t *slot = &t->slot[n & RELIABLE_MASK];
+		if (slot->msg && ReliableDue(slot) < due) due = ReliableDue(slot);
+	}
+	if (due <= now) return 0;
+
+	uint64_t ms = (due - now + 999999) / 1000000;
+	return (ms < RELIABLE_ACK_POLL ? (int) ms : RELIABLE_ACK_POLL);
+}
+
+//an ACK from the PIC - marks the frames in flight it covers. RX thread
+static void ReliableAckReceived(psMessage_t *msg)
+{
+	ReliableTx_t *t = &reliableTx;
+	uint64_t now = BrokerNow();
+
+	if (msg->header.length < ACK_LENGTH) return;
+
+	uint8_t cumulative = msg->packet[0] & RELIABLE_MASK;
+	uint32_t bits = msg->packet[1] | (msg->packet[2] << 8) | (msg->packet[3] << 16) | ((uint32_t) msg->packet[4] << 24);
+
+	uint32_t base = __atomic_load_n(&t->base, __ATOMIC_ACQUIRE);
+	uint32_t next = __atomic_load_n(&t->next, __ATOMIC_ACQUIRE);
+	uint32_t n;
+
+	for (n = base; n != next; n++)
+	{
+		int r = n & RELIABLE_MASK;
+		int d = (r - cumulative) & RELIABLE_MASK;
+
+		//behind the cumulative point, or in the selective bitmap
+		if (d >= RELIABLE_SPACE - PS_UART_WINDOW || (d > 0 && (bits & (1u << (d - 1)))))
+		{
+			if (__atomic_load_n(&t->acked[r >> 5], __ATOMIC_RELAXED) & (1u << (r & 31))) continue;
+			t->ackTime[r] = now;
+			__atomic_or_fetch(&t->acked[r >> 5], 1u << (r & 31), __ATOMIC_RELEASE);
+		}
 	}
 }
 
+//a reliable frame from the PIC - false if already delivered. RX thread
+static bool ReliableReceived(uint8_t r)
+{
+	ReliableRx_t *x = &reliableRx;
+	bool fresh = false;
+
+	if (!x->synced || x->stale >= RELIABLE_RESYNC)
+	{
+		if (x->synced)
+		{
+			DEBUGPRINT("uart RX: reliable sequence reset\n");
+		}
+		memset(x->seen, 0, sizeof(x->seen));
+		x->next = r;
+		x->stale = 0;
+		x->synced = true;
+	}
+
+	int d = (r - x->next) & RELIABLE_MASK;
+
+	if (d < RELIABLE_SPACE / 2)
+	{
+		x->stale = 0;
+		if (!BIT_TEST(x->seen, r))
+		{
+			BIT_SET(x->seen, r);
+			fresh = true;
+		}
+		//slide - numbers leaving the back half stay marked, the front half is cleared
+		while (BIT_TEST(x->seen, x->next))
+		{
+			BIT_CLEAR(x->seen, (x->next + RELIABLE_SPACE / 2) & RELIABLE_MASK);
+			x->next = (x->next + 1) & RELIABLE_MASK;
+		}
+	}
+	else
+	{
+		//behind the window - delivered long ago
+		x->stale++;
+	}
+
+	if (fresh) x->received++;
+	else x->duplicates++;
+	return fresh;
+}
+
+//ACK everything received so far - sent at once, between TX chunks. RX thread
+static void ReliableSendAck()
+{
+	ReliableRx_t *x = &reliableRx;
+	psMessage_t ack;
+	uint8_t frame[ACK_LENGTH + 7];
+	uint32_t bits = 0;
+	int i;
+
+	for (i=0; i<32; i++)
+	{
+		if (BIT_TEST(x->seen, (x->next + 1 + i) & RELIABLE_MASK)) bits |= (1u << i);
+	}
+
+	ack.header.length = ACK_LENGTH;
+	ack.header.source = OVERMIND;
+	ack.header.messageType = PS_LINK_ACK;
+	ack.packet[0] = x->next;
+	ack.packet[1] = bits;
+	ack.packet[2] = bits >> 8;
+	ack.packet[3] = bits >> 16;
+	ack.packet[4] = bits >> 24;
+
+	//sequence number unused - the PIC never routes an ACK
+	UartWrite(frame, (int)(FrameMessage(frame, &ack, 0) - frame), 1);
+}
+#endif
+
+//hold off while the link is a burst ahead - TX thread
+static void LinkHoldOff()
+{
+	uint64_t now = BrokerNow();
+	uint64_t ahead = (uint64_t) linkBudget.burst * 1000000000ULL / linkBudget.rate;
+	if (linkBudget.tat > now + ahead)
+	{
+		uint64_t wait = linkBudget.tat - now - ahead;
+		struct timespec ts = {(time_t)(wait / 1000000000ULL), (long)(wait % 1000000000ULL)};
+		nanosleep(&ts, NULL);
+	}
+}
+
+//always charged - a chunk may take the link into debt, and the next one waits. TX thread
+static void LinkCharge(long written)
+{
+	uint64_t now = BrokerNow();
+	if (linkBudget.tat < now) linkBudget.tat = now;
+	linkBudget.tat += (uint64_t) written * 1000000000ULL / linkBudget.rate;
+}
+
 //Tx thread - sends messages from the Tx Q
+//everything pending is framed into one buffer, then written a burst of whole frames at a time
+//paced by the link budget, so an ACK from the RX thread waits for one chunk, not the whole batch
 void *TxThread(void *a) {
-	int i;
-	int length;
-	char messageBuffer[MAX_UART_MESSAGE];
-	char *current;
+	psMessage_t *batch[BROKER_Q_BATCH];
+#ifdef PS_UART_RELIABLE
+	uint8_t txBuffer[(BROKER_Q_BATCH + PS_UART_WINDOW) * MAX_UART_MESSAGE];
+#else
+	uint8_t txBuffer[BROKER_Q_BATCH * MAX_UART_MESSAGE];
+#endif
+	uint8_t *current;
+	int count, length, frames, offset, chunk, i;
+	int timeout = -1;
+	int room = BROKER_Q_BATCH;
 	long written;
-	int checksum;
 	unsigned char sequenceNumber = 0;
 
 	DEBUGPRINT("TX ready\n");
 
 	for (;;) {
 
-		//wait for a message
-		psMessage_t *msg = GetNextMessage(&uartTxQueue);
+		//hold off while the link is a burst ahead - meanwhile newer urgent messages
+		//can overtake, and stale telemetry is trimmed from the queue
+		LinkHoldOff();
 
-		length =  msg->header.length + 7;   //stx, header(5), payload, checksum
+#ifdef PS_UART_RELIABLE
+		//with frames in flight wake for ACKs and retransmit timeouts too
+		ReliableCollect();
+		timeout = ReliableTimeout(BrokerNow());
 
-		current = messageBuffer;
-
-		*current++ = STX_CHAR;
-		*current++ = msg->header.length;
-		*current++ = ~msg->header.length;
-		*current++ = sequenceNumber;
-		sequenceNumber = (sequenceNumber + 1) & 0xff;
-		*current++ = msg->header.source;
-		*current++ = msg->header.messageType;
-
-		memcpy(current, msg->packet, msg->header.length);
-
-		checksum = 0;
-		for (i = 1; i < length-1; i++) {
-			checksum += messageBuffer[i];
+		//take no more than the backlog can hold - the rest wait on the queue, in order
+		room = RELIABLE_HOLD - reliableTx.heldCount;
+		if (room > BROKER_Q_BATCH) room = BROKER_Q_BATCH;
+		if (room == 0)
+		{
+			//the window is full, so timeout is a poll interval
+			struct timespec ts = {0, (long) timeout * 1000000};
+			nanosleep(&ts, NULL);
+			count = 0;
 		}
-		messageBuffer[length-1] = (checksum & 0xff);
-
-		written = write(picUartFD, messageBuffer, length);
-
-		if (written == length)
+		else
+#endif
+		//wait for messages, take all that are pending
+		count = GetNextMessages(&uartTxQueue, batch, room, timeout);
+
+		current = txBuffer;
+		frames = 0;
+#ifdef PS_UART_RELIABLE
+		//urgent messages go first, numbered and kept for retransmission
+		for (i=0; i<count; i++)
 		{
-			DEBUGPRINT("uart TX: %s\n", psLongMsgNames[msg->header.messageType]);
-		} else {
-			ERRORPRINT("uart TX: Failed to write to uart. %s\n", strerror(errno));
+			if (ReliableType(batch[i]->header.messageType)) ReliableHold(batch[i]);
 		}
+		ReliableCollect();
+		current = ReliableFrames(current, BrokerNow(), &frames);
+#endif
+		for (i=0; i<count; i++)
+		{
+#ifdef PS_UART_RELIABLE
+			if (ReliableType(batch[i]->header.messageType)) continue;
+#endif
+			current = FrameTelemetry(current, batch[i], sequenceNumber++ & BEST_EFFORT_SEQ);
+			frames++;
+			TRACEPRINT("uart TX: %s\n", psLongMsgNames[batch[i]->header.messageType]);
+		}
+		length = (int)(current - txBuffer);
 
-		if (psDefaultTopics[msg->header.messageType] == LOG_TOPIC)
+		//whole frames up to a burst per write - the write mutex is free between chunks
+		for (offset = 0; offset < length; offset += chunk)
 		{
-			switch (msg->logPayload.severity)
+			chunk = 0;
+			frames = 0;
+			while (offset + chunk < length)
 			{
-			case SYSLOG_ROUTINE:
-				routineCount--;
-				break;
-			case SYSLOG_INFO:
-				infoCount--;
-				break;
-			case SYSLOG_WARNING:
-				warningCount--;
-				break;
-			default:
-				errorCount--;
-				break;
+				int frameLength = txBuffer[offset + chunk + 1] + 7;
+				if (chunk > 0 && chunk + frameLength > (int) linkBudget.burst) break;
+				chunk += frameLength;
+				frames++;
 			}
+
+			if (offset > 0) LinkHoldOff();
+			written = UartWrite(txBuffer + offset, chunk, frames);
+			LinkCharge(written);
+			if (written < chunk) break;
 		}
-		DoneWithMessage(msg);
+
+		DoneWithMessages(batch, count);
 	}
 	return 0;
 }
 
+//a frame passed the checksum - count it, and any telemetry frames missed before it
+static void TrackFrame(RxTracker_t *t)
+{
+	uint8_t sequence = t->header[0];
+
+	uartLink.rxFrames++;
+	uartLink.rxBytes += t->length + 7;
+	t->sequence = sequence;
+
+#ifdef PS_UART_RELIABLE
+	//reliable frames and ACKs are not in the telemetry sequence
+	if ((sequence & RELIABLE_FLAG) || t->header[2] == PS_LINK_ACK) return;
+#endif
+	if (t->synced)
+	{
+		uint8_t gap = (sequence - t->last - 1) & BEST_EFFORT_SEQ;
+
+		//a jump of more than half the space is the PIC restarting
+		if (gap > 0 && gap <= BEST_EFFORT_SEQ / 2) uartLink.rxGaps += gap;
+	}
+	t->last = sequence;
+	t->synced = true;
+}
+
+//follow one received byte through the framing - stx, length, ~length, sequence, source, type, payload, checksum
+static inline void TrackByte(RxTracker_t *t, uint8_t c)
+{
+	switch (t->state)
+	{
+	case TRACK_STX:
+		if (c == STX_CHAR) t->state = TRACK_LENGTH;
+		else uartLink.rxSkipped++;
+		break;
+	case TRACK_LENGTH:
+		t->length = c;
+		t->sum = c;
+		t->state = TRACK_LENGTH2;
+		break;
+	case TRACK_LENGTH2:
+		if ((uint8_t) ~t->length != c || t->length > PS_MAX_PAYLOAD)
+		{
+			uartLink.rxLength++;
+			t->state = (c == STX_CHAR ? TRACK_LENGTH : TRACK_STX);
+		}
+		else
+		{
+			t->sum += c;
+			t->index = 0;
+			t->remaining = t->length + 4;
+			t->state = TRACK_BODY;
+		}
+		break;
+	case TRACK_BODY:
+		if (--t->remaining > 0)
+		{
+			if (t->index < 3) t->header[t->index++] = c;
+			t->sum += c;
+		}
+		else
+		{
+			if (t->sum == c) TrackFrame(t);
+			else uartLink.rxChecksum++;
+			t->state = TRACK_STX;
+		}
+		break;
+	}
+}
+
+//change in a counter since the last report - stats thread
+static inline uint32_t LinkDelta(uint32_t *counter, uint32_t *last)
+{
+	uint32_t now = __atomic_load_n(counter, __ATOMIC_RELAXED);
+	uint32_t delta = now - *last;
+	*last = now;
+	return delta;
+}
+
+//link health each stats period - frame rates, errors and write stalls since the last report
+static void SerialLinkStats(FILE *f)
+{
+	static UartLinkStats_t last;
+	static uint32_t lastReadErrors;
+	UartLinkStats_t *l = &uartLink;
+
+	uint32_t rxFrames = LinkDelta(&l->rxFrames, &last.rxFrames);
+	uint32_t txFrames = LinkDelta(&l->txFrames, &last.txFrames);
+	uint32_t rxBytes = LinkDelta(&l->rxBytes, &last.rxBytes);
+	uint32_t txBytes = LinkDelta(&l->txBytes, &last.txBytes);
+	uint32_t checksum = LinkDelta(&l->rxChecksum, &last.rxChecksum);
+	uint32_t length = LinkDelta(&l->rxLength, &last.rxLength);
+	uint32_t gaps = LinkDelta(&l->rxGaps, &last.rxGaps);
+	uint32_t skipped = LinkDelta(&l->rxSkipped, &last.rxSkipped);
+	uint32_t writeErrors = LinkDelta(&l->writeErrors, &last.writeErrors);
+	uint32_t readErrors = LinkDelta(&picUartReader.errors, &lastReadErrors);
+	uint32_t writes = LinkDelta(&l->writes, &last.writes);
+	uint64_t writeNs = __atomic_load_n(&l->writeNs, __ATOMIC_RELAXED);
+	uint64_t stallNs = writeNs - last.writeNs;
+	uint64_t maxNs = __atomic_exchange_n(&l->writeMaxNs, 0, __ATOMIC_RELAXED);
+	last.writeNs = writeNs;
+
+	PublishStat("uart", "rx/s", rxFrames / PS_STATS_PERIOD);
+	PublishStat("uart", "tx/s", txFrames / PS_STATS_PERIOD);
+	PublishStat("uart", "rx B/s", rxBytes / PS_STATS_PERIOD);
+	PublishStat("uart", "tx B/s", txBytes / PS_STATS_PERIOD);
+	PublishStat("uart", "stall uS", (writes ? (int)(stallNs / writes / 1000) : 0));
+	PublishStat("uart", "stall max", (int)(maxNs / 1000));
+
+	//errors only when there are some
+	if (checksum) PublishStat("uart", "crc err", checksum);
+	if (length) PublishStat("uart", "len err", length);
+	if (gaps) PublishStat("uart", "seq gap", gaps);
+	if (skipped) PublishStat("uart", "resync B", skipped);
+	if (readErrors) PublishStat("uart", "rd err", readErrors);
+	if (writeErrors) PublishStat("uart", "wr err", writeErrors);
+
+#ifdef PS_UART_RELIABLE
+	static uint32_t lastRetransmits, lastAbandoned, lastDuplicates;
+	uint32_t retransmits = LinkDelta(&reliableTx.retransmits, &lastRetransmits);
+	uint32_t abandoned = LinkDelta(&reliableTx.abandoned, &lastAbandoned);
+	uint32_t duplicates = LinkDelta(&reliableRx.duplicates, &lastDuplicates);
+
+	PublishStat("uart", "srtt uS", (int)(__atomic_load_n(&reliableTx.srtt, __ATOMIC_RELAXED) / 1000));
+	if (retransmits) PublishStat("uart", "retx", retransmits);
+	if (abandoned) PublishStat("uart", "abandon", abandoned);
+	if (duplicates) PublishStat("uart", "dup", duplicates);
+#endif
+#ifdef PS_UART_COMPACT
+	static uint32_t lastResyncs;
+	uint32_t resyncs = LinkDelta(&rxCodec.resyncs, &lastResyncs);
+	if (resyncs) PublishStat("uart", "codec rs", resyncs);
+#endif
+
+	if (f)
+	{
+		fprintf(f, "\nuart rx: %u frames, %u bytes, %u checksum, %u length, %u gaps, %u skipped, %u read errors\n",
+				l->rxFrames, l->rxBytes, l->rxChecksum, l->rxLength, l->rxGaps, l->rxSkipped, picUartReader.errors);
+		fprintf(f, "uart tx: %u frames, %u bytes, %u write errors, %.1f uS mean write\n",
+				l->txFrames, l->txBytes, l->writeErrors,
+				(l->writes ? l->writeNs / 1000.0 / l->writes : 0.0));
+#ifdef PS_UART_RELIABLE
+		fprintf(f, "uart reliable: %u sent, %u retransmitted, %u abandoned, %u received, %u duplicates, srtt %.1f mS rto %.1f mS\n",
+				reliableTx.sent, reliableTx.retransmits, reliableTx.abandoned,
+				reliableRx.received, reliableRx.duplicates, reliableTx.srtt / 1e6, reliableTx.rto / 1e6);
+#endif
+#ifdef PS_UART_COMPACT
+		fprintf(f, "uart codec: tx %u of %u bytes, rx %u of %u bytes, %u resyncs\n",
+				txCodec.wireBytes, txCodec.rawBytes, rxCodec.wireBytes, rxCodec.rawBytes, rxCodec.resyncs);
+#endif
+	}
+}
+
 //receives messages and passes to broker
 void *RxThread(void *a) {
 	int messageComplete;
 	psMessage_t msg;
-	uint8_t c;
+	int c;
 
 	status_t parseStatus;
 
@@ -237,24 +947,56 @@ void *RxThread(void *a) {
 	parseStatus.noTopic		= 1;	///< Do not check for topic ID, if > 0
 	ResetParseStatus(&parseStatus);
 
+#ifdef PS_UART_RELIABLE
+	parseStatus.noSeq		= 1;	//two sequence spaces - checked here
+	ResetParseStatus(&parseStatus);
+#endif
+
+	uart_reader_init(&picUartReader, picUartFD);
+
 	DEBUGPRINT("RX ready\n");
 
 	for (;;) {
 		do {
 			messageComplete = 0;
 
-			int count = (int) read(picUartFD, &c, 1);
+			//one read() per burst, the parser is fed from the buffer
+			c = uart_getc(&picUartReader);
 
-			if (count == 1)
+			if (c >= 0)
 			{
-				messageComplete = ParseNextCharacter(c, &msg, &parseStatus);
+				TrackByte(&rxTracker, (uint8_t) c);
+				messageComplete = ParseNextCharacter((uint8_t) c, &msg, &parseStatus);
 			}
 		} while (messageComplete == 0);
 
+#ifdef PS_UART_RELIABLE
+		if (msg.header.messageType == PS_LINK_ACK)
+		{
+			ReliableAckReceived(&msg);
+			continue;
+		}
+
+		//the tracker has seen the same frame
+		uint8_t sequence = rxTracker.sequence;
+		if (sequence & RELIABLE_FLAG)
+		{
+			bool fresh = ReliableReceived(sequence & RELIABLE_MASK);
+
+			//duplicates too - our last ACK was lost
+			ReliableSendAck();
+			if (!fresh) continue;
+		}
+#endif
+
+#ifdef PS_UART_COMPACT
+		if (psWireDecode(&rxCodec, &msg) < 0) continue;
+#endif
+
 		if (msg.header.source != OVERMIND) {
-			DEBUGPRINT("uart RX: %s\n", psLongMsgNames[msg.header.messageType]);
-			//route the message
-			RouteMessage(&msg);
+			TRACEPRINT("uart RX: %i\n", msg.header.messageType);
+			//same ingress as local publishers - validated and queued for its dispatcher
+			NewBrokerMessage(&msg);
 		}
 	}
 	return 0;
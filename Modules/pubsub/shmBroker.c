@@ -0,0 +1,155 @@
+/*
+ * shmBroker.c
+ *
+ * Writer side of the shared-memory transport
+ *
+ * Subscribes a zero-copy queue to every message type and copies each message once into
+ * the shm ring. The export costs an append per message whether or not a tool is attached,
+ * so it is off unless PS_SHM_TRANSPORT is defined. Readers add nothing to that - they
+ * filter and copy out for themselves.
+ *
+ *      Author: martin
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "PubSubData.h"
+#include "pubsub/pubsub.h"
+#include "syslog/syslog.h"
+#include "SoftwareProfile.h"
+
+#include "brokerQ.h"
+#include "shmBroker.h"
+#include "broker_debug.h"
+
+//broker side queue
+BrokerQueue_t shmQueue = BROKER_Q_INITIALIZER;
+
+psShmRing_t *shmRing;
+
+void *ShmTxThread(void *a);
+
+pthread_t ShmBrokerInit()
+{
+	int i;
+
+	int fd = shm_open(PS_SHM_NAME, O_CREAT | O_RDWR, PS_SHM_MODE);
+	if (fd < 0)
+	{
+		ERRORPRINT("shm_open %s: %s\n", PS_SHM_NAME, strerror(errno));
+		return -1;
+	}
+	//past the umask, so tools run as other users can attach
+	if (fchmod(fd, PS_SHM_MODE) < 0)
+	{
+		ERRORPRINT("shm fchmod: %s\n", strerror(errno));
+	}
+	if (ftruncate(fd, sizeof(psShmRing_t)) < 0)
+	{
+		ERRORPRINT("shm ftruncate: %s\n", strerror(errno));
+		close(fd);
+		return -1;
+	}
+	shmRing = mmap(NULL, sizeof(psShmRing_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shmRing == MAP_FAILED)
+	{
+		ERRORPRINT("shm mmap: %s\n", strerror(errno));
+		shmRing = NULL;
+		return -1;
+	}
+
+	//a segment left by an earlier run of the same build carries on from its head,
+	//so attached readers see a gap rather than a reset
+	if (shmRing->magic != PS_SHM_MAGIC || shmRing->version != PS_SHM_VERSION
+			|| shmRing->slots != PS_SHM_SLOTS || shmRing->slotSize != sizeof(psShmSlot_t))
+	{
+		memset(shmRing, 0, sizeof(psShmRing_t));
+		shmRing->version = PS_SHM_VERSION;
+		shmRing->slots = PS_SHM_SLOTS;
+		shmRing->slotSize = sizeof(psShmSlot_t);
+		__atomic_store_n(&shmRing->magic, PS_SHM_MAGIC, __ATOMIC_RELEASE);
+	}
+	shmRing->writerPid = getpid();
+
+	//never hold up the dispatchers - a slow ring loses its oldest messages
+	SetQueuePolicy(&shmQueue, PS_SHM_Q_DEPTH, BROKER_Q_DROP_OLDEST);
+	psRegisterQueueStats(&shmQueue, "shm");
+
+	for (i=0; i<PS_MSG_COUNT; i++)
+	{
+		psSubscribeQueue(i, &shmQueue);
+	}
+
+	pthread_t thread;
+	int s = pthread_create(&thread, NULL, ShmTxThread, NULL);
+	if (s != 0)
+	{
+		ERRORPRINT("shm: pthread_create failed. %s\n", strerror(s));
+		return -1;
+	}
+	return thread;
+}
+
+//seqlock write - odd count, message, position, even count
+//a slot left odd by a writer that died mid copy is evened up, or its parity would stay inverted
+static inline void ShmWriteSlot(psShmSlot_t *slot, uint32_t position, psMessage_t *msg)
+{
+	uint32_t seq = slot->seq & ~1u;
+
+	__atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	//header and the payload in use
+	memcpy(&slot->msg, msg, offsetof(psMessage_t, packet) + msg->header.length);
+	__atomic_store_n(&slot->position, position, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+//copies broker messages into the ring, one head update and wake per batch
+void *ShmTxThread(void *a)
+{
+	psMessage_t *batch[BROKER_Q_BATCH];
+	uint32_t head = shmRing->head;		//only this thread writes it
+	int n, i;
+
+	DEBUGPRINT("shm ready\n");
+
+	while (1)
+	{
+		n = GetNextMessages(&shmQueue, batch, BROKER_Q_BATCH, -1);
+
+		for (i=0; i<n; i++)
+		{
+			ShmWriteSlot(&shmRing->slot[head & PS_SHM_MASK], head, batch[i]);
+			head++;
+		}
+		DoneWithMessages(batch, n);
+
+		__atomic_store_n(&shmRing->head, head, __ATOMIC_RELEASE);
+
+		//pairs with the reader's waiters increment before it parks
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&shmRing->waiters, __ATOMIC_RELAXED))
+		{
+			//shared futex - the readers are other processes
+			syscall(SYS_futex, &shmRing->head, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+		}
+	}
+	return 0;
+}
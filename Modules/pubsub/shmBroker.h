@@ -0,0 +1,75 @@
+/*
+ * shmBroker.h
+ *
+ * Shared-memory pubsub transport - a broadcast ring of messages in a POSIX shm segment
+ *
+ * The fido process is the only writer. Any number of local processes (logger, visualizer,
+ * replay) read the ring at their own pace, with no subscription state in the broker.
+ * Each slot is guarded by a sequence count (odd while being written), so a reader that
+ * is lapped sees the overwrite and counts it as lost rather than reading a torn message.
+ *
+ *      Author: martin
+ */
+
+#ifndef SHMBROKER_H_
+#define SHMBROKER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "PubSubData.h"
+
+#define PS_SHM_NAME			"/fido.pubsub"		//shm_open name
+#define PS_SHM_MODE			0666				//readers map it read-write to count waiters
+#define PS_SHM_MAGIC		0x46505342			//"FPSB"
+#define PS_SHM_VERSION		1
+
+//ring size - must be a power of 2
+#define PS_SHM_SLOTS		1024
+#define PS_SHM_MASK			(PS_SHM_SLOTS - 1)
+
+#define PS_SHM_Q_DEPTH		64		//broker side queue, drop-oldest
+
+#define PS_SHM_CACHE_LINE	64
+
+typedef struct {
+	uint32_t seq;					//odd while the writer is in the slot
+	uint32_t position;				//ring position last written here
+	psMessage_t msg;
+} psShmSlot_t;
+
+//segment layout - positions are free-running 32 bit counts, slot = position & PS_SHM_MASK
+typedef struct {
+	uint32_t magic;					//set last by the writer
+	uint32_t version;
+	uint32_t slots;
+	uint32_t slotSize;				//sizeof(psShmSlot_t) - catches readers built against other message sets
+	int32_t writerPid;
+
+	uint32_t head __attribute__((aligned(PS_SHM_CACHE_LINE)));	//next position to write - futex word
+	uint32_t waiters;				//readers parked on head
+
+	psShmSlot_t slot[PS_SHM_SLOTS] __attribute__((aligned(PS_SHM_CACHE_LINE)));
+} psShmRing_t;
+
+//writer - in the fido process, after PubSubInit
+pthread_t ShmBrokerInit();
+
+//reader (shmClient.c) - links against PubSubData.c only
+#define PS_SHM_TOPIC(t)		(1u << (t))		//topic filter bit
+#define PS_SHM_ALL_TOPICS	0
+
+typedef struct {
+	psShmRing_t *ring;
+	uint32_t next;					//next position to read
+	uint32_t topics;				//PS_SHM_TOPIC bits, PS_SHM_ALL_TOPICS = everything
+	uint32_t received;				//messages returned
+	uint32_t lost;					//overwritten before they were read
+} psShmReader_t;
+
+int psShmOpen(psShmReader_t *r, uint32_t topics);		//attach at the current head. -1 if no writer has run
+int psShmNext(psShmReader_t *r, psMessage_t *msg, int timeout);	//copy out the next message - 1, or 0 after timeout mS (-1 forever)
+void psShmClose(psShmReader_t *r);
+
+#endif /* SHMBROKER_H_ */
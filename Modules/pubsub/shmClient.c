@@ -0,0 +1,147 @@
+/*
+ * shmClient.c
+ *
+ * Reader side of the shared-memory transport - for tools outside the fido process
+ *
+ * Needs only PubSubData.c (for the topic of each message type), not the broker.
+ *
+ *      Author: martin
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "PubSubData.h"
+#include "shmBroker.h"
+
+//attach to the ring and start from the current head
+int psShmOpen(psShmReader_t *r, uint32_t topics)
+{
+	memset(r, 0, sizeof(psShmReader_t));
+
+	//read-write for the waiters count only - the writer creates the segment PS_SHM_MODE
+	int fd = shm_open(PS_SHM_NAME, O_RDWR, 0);
+	if (fd < 0)
+	{
+		fprintf(stderr, "shm_open %s: %s\n", PS_SHM_NAME, strerror(errno));
+		return -1;
+	}
+	psShmRing_t *ring = mmap(NULL, sizeof(psShmRing_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ring == MAP_FAILED)
+	{
+		fprintf(stderr, "shm mmap: %s\n", strerror(errno));
+		return -1;
+	}
+
+	if (__atomic_load_n(&ring->magic, __ATOMIC_ACQUIRE) != PS_SHM_MAGIC
+			|| ring->version != PS_SHM_VERSION
+			|| ring->slots != PS_SHM_SLOTS || ring->slotSize != sizeof(psShmSlot_t))
+	{
+		fprintf(stderr, "%s: not a ring from this build\n", PS_SHM_NAME);
+		munmap(ring, sizeof(psShmRing_t));
+		return -1;
+	}
+
+	r->ring = ring;
+	r->topics = topics;
+	r->next = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	return 0;
+}
+
+void psShmClose(psShmReader_t *r)
+{
+	if (r->ring) munmap(r->ring, sizeof(psShmRing_t));
+	r->ring = NULL;
+}
+
+//park on head until it moves past 'head' or the deadline passes
+//returns -1 on timeout
+static int ShmWait(psShmRing_t *ring, uint32_t head, const struct timespec *deadline)
+{
+	int reply = 0;
+
+	__atomic_add_fetch(&ring->waiters, 1, __ATOMIC_SEQ_CST);
+
+	//shared futex - returns at once if the writer moved head since we sampled it
+	int s = syscall(SYS_futex, &ring->head, FUTEX_WAIT_BITSET, head, deadline, NULL, FUTEX_BITSET_MATCH_ANY);
+	if (s != 0 && errno == ETIMEDOUT) reply = -1;
+
+	__atomic_sub_fetch(&ring->waiters, 1, __ATOMIC_RELAXED);
+	return reply;
+}
+
+//copy out the next message on a subscribed topic
+//returns 1, or 0 if none arrived within timeout mS (-1 = forever, 0 = no wait)
+int psShmNext(psShmReader_t *r, psMessage_t *msg, int timeout)
+{
+	psShmRing_t *ring = r->ring;
+	struct timespec deadline;
+
+	if (timeout > 0)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += timeout / 1000;
+		deadline.tv_nsec += (timeout % 1000) * 1000000;
+		if (deadline.tv_nsec >= 1000000000)
+		{
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+	}
+
+	while (1)
+	{
+		uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+		if (head == r->next)
+		{
+			if (timeout == 0) return 0;
+			if (ShmWait(ring, head, (timeout > 0 ? &deadline : NULL)) < 0) return 0;
+			continue;
+		}
+
+		//lapped - skip to the oldest slot still in the ring
+		if (head - r->next > PS_SHM_SLOTS)
+		{
+			r->lost += head - r->next - PS_SHM_SLOTS;
+			r->next = head - PS_SHM_SLOTS;
+		}
+
+		psShmSlot_t *slot = &ring->slot[r->next & PS_SHM_MASK];
+
+		uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		uint32_t position = __atomic_load_n(&slot->position, __ATOMIC_RELAXED);
+		memcpy(msg, &slot->msg, sizeof(psMessage_t));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+		//odd or changed count, or a later position - the writer has been back here since
+		if ((seq & 1) || position != r->next || __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq)
+		{
+			r->lost++;
+			r->next++;
+			continue;
+		}
+		r->next++;
+
+		if (r->topics != PS_SHM_ALL_TOPICS)
+		{
+			unsigned type = msg->header.messageType;
+			if (type >= PS_MSG_COUNT || (r->topics & PS_SHM_TOPIC(psDefaultTopics[type])) == 0) continue;
+		}
+
+		r->received++;
+		return 1;
+	}
+}
@@ -0,0 +1,227 @@
+/*
+ * wireCodec.c
+ *
+ * Compact payload encoding for the serial link - see wireCodec.h
+ *
+ * Compact payload: position since keyframe, reference check, change bitmap (a bit per word),
+ * then a zigzag varint per changed word
+ *
+ *      Author: martin
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "PubSubData.h"
+#include "wireCodec.h"
+
+//fixed size formats can be delta coded - variable length ones are sized PS_MAX_PAYLOAD
+#define formatmacro(e,t,v,s) ((s) > 0 && (s) < PS_MAX_PAYLOAD),
+static const uint8_t wireEligible[PS_FORMAT_COUNT] = {
+#include "Messages/MsgFormatList.h"
+};
+#undef formatmacro
+
+uint8_t psWireTypes[PS_MSG_COUNT];
+
+#define WIRE_HEADER		2		//position, reference check
+
+//urgent (first QOS) messages always go whole - they can overtake, and be retransmitted
+int psWireCompact(psMessageType_enum type)
+{
+	if ((unsigned) type >= PS_MSG_COUNT || psQOS[type] == 0) return -1;
+
+	int format = psMsgFormats[type];
+	if (format < 0 || format >= PS_FORMAT_COUNT || !wireEligible[format]) return -1;
+
+	psWireTypes[type] = 1;
+	return 0;
+}
+
+void psWireCodecInit(psWireCodec_t *c)
+{
+	memset(c, 0, sizeof(psWireCodec_t));
+}
+
+static inline bool WireType(int type)
+{
+	return ((unsigned) type < PS_MSG_COUNT && psWireTypes[type]);
+}
+
+//little-endian word of up to 4 bytes - both ends agree whatever their byte order
+static inline uint32_t LoadWord(const uint8_t *p, int n)
+{
+	uint32_t w = 0;
+	int i;
+	for (i=0; i<n && i<4; i++) w |= (uint32_t) p[i] << (8 * i);
+	return w;
+}
+
+static inline void StoreWord(uint8_t *p, uint32_t w, int n)
+{
+	int i;
+	for (i=0; i<n && i<4; i++) p[i] = (uint8_t)(w >> (8 * i));
+}
+
+//a byte hash of the reference - catches a lost keyframe the position cannot
+static inline uint8_t ReferenceCheck(const uint8_t *p, int n)
+{
+	uint32_t h = 2166136261u;
+	while (n-- > 0) h = (h ^ *p++) * 16777619u;
+	return (uint8_t)(h ^ (h >> 8) ^ (h >> 16) ^ (h >> 24));
+}
+
+//new reference - a keyframe
+static void SetReference(psWireCodec_t *c, int type, const uint8_t *payload, int length)
+{
+	memcpy(c->reference[type], payload, length);
+	c->length[type] = length;
+	c->position[type] = 0;
+	c->valid[type] = true;
+	c->keyframes++;
+}
+
+int psWireEncode(psWireCodec_t *c, const psMessage_t *msg, uint8_t *packet)
+{
+	int type = msg->header.messageType;
+	int length = msg->header.length;
+	int words = (length + 3) / 4;
+	int mapBytes = (words + 7) / 8;
+	int w;
+
+	if (!WireType(type)) return 0;
+
+	c->rawBytes += length;
+
+	if (c->valid[type] && c->length[type] == length && c->position[type] + 1 < PS_WIRE_KEYFRAME
+			&& WIRE_HEADER + mapBytes < length)
+	{
+		const uint8_t *reference = c->reference[type];
+		uint8_t *map = packet + WIRE_HEADER;
+		uint8_t *current = map + mapBytes;
+		uint8_t *limit = packet + length;		//must come out shorter than the payload
+
+		memset(map, 0, mapBytes);
+
+		for (w=0; w<words; w++)
+		{
+			int n = length - 4 * w;
+			uint32_t d = LoadWord(msg->packet + 4 * w, n) - LoadWord(reference + 4 * w, n);
+
+			if (d == 0) continue;
+			map[w >> 3] |= (1 << (w & 7));
+
+			uint32_t z = (d << 1) ^ (uint32_t)((int32_t) d >> 31);
+			do {
+				if (current >= limit) break;
+				*current++ = (uint8_t)((z & 0x7f) | (z > 0x7f ? 0x80 : 0));
+				z >>= 7;
+			} while (z);
+
+			if (z || current >= limit) break;
+		}
+
+		if (w == words && current < limit)
+		{
+			packet[0] = c->position[type] + 1;
+			packet[1] = ReferenceCheck(reference, length);
+
+			memcpy(c->reference[type], msg->packet, length);
+			c->position[type]++;
+			c->deltas++;
+			c->wireBytes += (uint32_t)(current - packet);
+			return (int)(current - packet);
+		}
+	}
+
+	SetReference(c, type, msg->packet, length);
+	c->wireBytes += length;
+	return 0;
+}
+
+int psWireDecode(psWireCodec_t *c, psMessage_t *msg)
+{
+	int type = msg->header.messageType & ~PS_WIRE_COMPACT;
+	int wireLength = msg->header.length;
+	uint8_t payload[PS_MAX_PAYLOAD];
+	int w;
+
+	if ((msg->header.messageType & PS_WIRE_COMPACT) == 0)
+	{
+		if (WireType(type))
+		{
+			SetReference(c, type, msg->packet, wireLength);
+			c->rawBytes += wireLength;
+			c->wireBytes += wireLength;
+		}
+		return 0;
+	}
+
+	if (!WireType(type)) return -1;
+
+	c->wireBytes += wireLength;
+
+	int length = c->length[type];
+	int words = (length + 3) / 4;
+	int mapBytes = (words + 7) / 8;
+	const uint8_t *reference = c->reference[type];
+
+	//a frame since the reference was lost - wait for the next keyframe
+	if (!c->valid[type] || wireLength < WIRE_HEADER + mapBytes
+			|| msg->packet[0] != (uint8_t)(c->position[type] + 1)
+			|| msg->packet[1] != ReferenceCheck(reference, length))
+	{
+		c->valid[type] = false;
+		c->resyncs++;
+		return -1;
+	}
+
+	const uint8_t *map = msg->packet + WIRE_HEADER;
+	const uint8_t *current = map + mapBytes;
+	const uint8_t *end = msg->packet + wireLength;
+
+	memcpy(payload, reference, length);
+
+	for (w=0; w<words; w++)
+	{
+		if ((map[w >> 3] & (1 << (w & 7))) == 0) continue;
+
+		uint32_t z = 0;
+		int shift = 0;
+		uint8_t b;
+		do {
+			if (current >= end || shift > 28)
+			{
+				c->valid[type] = false;
+				c->resyncs++;
+				return -1;
+			}
+			b = *current++;
+			z |= (uint32_t)(b & 0x7f) << shift;
+			shift += 7;
+		} while (b & 0x80);
+
+		int n = length - 4 * w;
+		uint32_t d = (z >> 1) ^ (0u - (z & 1));
+		StoreWord(payload + 4 * w, LoadWord(reference + 4 * w, n) + d, n);
+	}
+
+	if (current != end)
+	{
+		c->valid[type] = false;
+		c->resyncs++;
+		return -1;
+	}
+
+	memcpy(c->reference[type], payload, length);
+	c->position[type]++;
+	c->deltas++;
+	c->rawBytes += length;
+
+	memcpy(msg->packet, payload, length);
+	msg->header.length = length;
+	msg->header.messageType = type;
+	return 1;
+}
@@ -0,0 +1,63 @@
+/*
+ * wireCodec.h
+ *
+ * Compact payload encoding for the serial link
+ *
+ * A payload is taken as little-endian 32 bit words. A compact frame carries only the words
+ * that changed since the last frame of the same type - a bitmap of which, then each change
+ * as a zigzag varint of the difference. Slowly moving fields (odometry counts, headings,
+ * positions) cost a byte or two instead of four.
+ *
+ * Every PS_WIRE_KEYFRAME frames, or when a delta would be no shorter, the payload goes as
+ * is. A plain frame is the reference for the deltas that follow it. Each compact frame
+ * also carries its place since the keyframe and a check byte of its reference, so after
+ * a lost frame the receiver drops deltas until the next keyframe rather than apply them
+ * to the wrong reference.
+ *
+ * Enabled per message type - only types of a fixed size format from Messages/MsgFormatList.h,
+ * and never urgent (first QOS) ones. Other types sharing the format still go whole.
+ * Both ends of a link must enable the same types.
+ *
+ *      Author: martin
+ */
+
+#ifndef WIRECODEC_H_
+#define WIRECODEC_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "PubSubData.h"
+
+#define PS_WIRE_COMPACT		0x80		//set in the frame message type of a compact payload
+#define PS_WIRE_KEYFRAME	16			//at most this many frames per type between keyframes
+
+//one direction of a link
+typedef struct {
+	uint8_t reference[PS_MSG_COUNT][PS_MAX_PAYLOAD];	//last payload of each type
+	uint8_t length[PS_MSG_COUNT];						//its length
+	uint8_t position[PS_MSG_COUNT];						//frames since its keyframe
+	bool valid[PS_MSG_COUNT];
+
+	//counters
+	uint32_t rawBytes;					//payload bytes of the enabled types
+	uint32_t wireBytes;					//as sent or received
+	uint32_t keyframes;
+	uint32_t deltas;
+	uint32_t resyncs;					//deltas dropped after a lost frame
+} psWireCodec_t;
+
+extern uint8_t psWireTypes[PS_MSG_COUNT];		//types using the codec
+
+int psWireCompact(psMessageType_enum type);		//enable a type, -1 if urgent or not fixed size
+void psWireCodecInit(psWireCodec_t *c);
+
+//encode 'msg' into 'packet' - returns the compact length, or 0 to send the payload as is
+//either way 'msg' becomes the reference for its type
+int psWireEncode(psWireCodec_t *c, const psMessage_t *msg, uint8_t *packet);
+
+//decode a received message in place - 1 if it was compact, 0 if plain,
+//-1 if it cannot be decoded (drop it)
+int psWireDecode(psWireCodec_t *c, psMessage_t *msg);
+
+#endif /* WIRECODEC_H_ */
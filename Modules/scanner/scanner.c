@@ -191,6 +191,9 @@ pthread_t ScannerInit()
 		scanData[s].weight = 0;
 	}
 
+	psSubscribe(PROXREP, ScannerProcessMessage);
+	psSubscribe(FOCUS, ScannerProcessMessage);
+
 	//create scanner thread
 	pthread_t thread;
 	int result = pthread_create(&thread, NULL, ScannerThread, NULL);
@@ -42,6 +42,12 @@ pthread_t SysLogInit()
         	fprintf(stderr, "syslog: Logfile opened on %s\n", LOGFILENAME);
         }
 
+    psRegisterQueueStats(&logQueue, "log");
+
+    //log messages from the broker
+    psSubscribe(SYSLOG_MSG, LogProcessMessage);
+    psSubscribe(BBBLOG_MSG, LogProcessMessage);
+
     //start log print threads
     pthread_t thread;
 
@@ -56,6 +62,10 @@ pthread_t SysLogInit()
 //writes log messages to the logfile
 void *LoggingThread(void *arg)
 {
+	psMessage_t *batch[BROKER_Q_BATCH];
+	int batchCount = 0;
+	int batchNext = 0;
+
     {
     	psMessage_t msg;
     	psInitPublish(msg, BBBLOG_MSG);
@@ -67,7 +77,13 @@ void *LoggingThread(void *arg)
     }
 	while (1)
 	{
-		psMessage_t *msg = GetNextMessage(&logQueue);
+		//take pending messages a batch at a time
+		if (batchNext == batchCount)
+		{
+			batchCount = GetNextMessages(&logQueue, batch, BROKER_Q_BATCH, -1);
+			batchNext = 0;
+		}
+		psMessage_t *msg = batch[batchNext++];
 		uint8_t severity;
 
 		if (msg->header.messageType == BBBLOG_MSG)
@@ -104,14 +120,18 @@ void *LoggingThread(void *arg)
 		//print to logfile
 		if (SYSLOG_LEVEL <= severity) {
 			PrintLogMessage(logFile, msg);
-			fflush(logFile);
 		}
         //print a copy to stderr
         if (LOG_TO_SERIAL <= severity) {
         	PrintLogMessage(stderr, msg);
-        	fflush(stderr);
         }
         DoneWithMessage(msg);
+
+        //flush once the batch is written
+        if (batchNext == batchCount) {
+        	fflush(logFile);
+        	fflush(stderr);
+        }
 	}
 	return 0;
 }
@@ -11,6 +11,8 @@
 #include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <errno.h>
+#include <termios.h>
 #include "uart.h"
 #include "common.h"
 
@@ -30,3 +32,65 @@ int uart_setup(const char *txpin, const char *rxpin)
     return 0;
 }
 
+
+int uart_configure(int fd, speed_t baudrate, int vmin, int vtime)
+{
+	struct termios settings;
+
+	if (tcgetattr(fd, &settings) != 0) {
+		printf("tcgetattr failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	//no processing
+	settings.c_iflag = 0;
+	settings.c_oflag = 0;
+	settings.c_lflag = 0;
+	settings.c_cflag = CLOCAL | CREAD | CS8;        //no modem, 8-bits
+
+	//read() wake-up
+	settings.c_cc[VMIN] = vmin;
+	settings.c_cc[VTIME] = vtime;
+
+	//baudrate
+	cfsetospeed(&settings, baudrate);
+	cfsetispeed(&settings, baudrate);
+
+	if (tcsetattr(fd, TCSANOW, &settings) != 0) {
+		printf("tcsetattr failed: %s\n", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+void uart_reader_init(UartReader_t *r, int fd)
+{
+	memset(r, 0, sizeof(UartReader_t));
+	r->fd = fd;
+}
+
+//buffer drained - one read() for whatever has arrived
+int uart_fill(UartReader_t *r)
+{
+	while (1)
+	{
+		int n = (int) read(r->fd, r->buffer, UART_RX_BUFFER);
+
+		if (n > 0)
+		{
+			r->reads++;
+			r->bytes += n;
+			r->count = n;
+			r->next = 1;
+			return r->buffer[0];
+		}
+		else if (n < 0 && errno != EINTR && errno != EAGAIN)
+		{
+			//don't spin on a dead port
+			r->errors++;
+			usleep(10000);
+			return -1;
+		}
+		//vmin 0 timeout or interrupted
+	}
+}
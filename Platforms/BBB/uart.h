@@ -8,7 +8,36 @@
 #ifndef UART_H
 #define	UART_H
 
+#include <stdint.h>
+#include <termios.h>
+
 int uart_setup(const char *txpin, const char *rxpin);
 
+//raw 8N1, no modem control
+//read() returns once vmin bytes are in, or vtime deciseconds after the last byte (vmin 1, vtime 0 = every byte)
+int uart_configure(int fd, speed_t baudrate, int vmin, int vtime);
+
+//buffered receive - one read() takes everything the driver holds, and the parser is fed from the buffer
+#define UART_RX_BUFFER	4096
+
+typedef struct {
+	int fd;
+	int next;			//next byte to hand out
+	int count;			//bytes in the buffer
+	uint32_t reads;		//read() calls
+	uint32_t bytes;		//bytes received
+	uint32_t errors;	//failed reads
+	uint8_t buffer[UART_RX_BUFFER];
+} UartReader_t;
+
+void uart_reader_init(UartReader_t *r, int fd);
+int uart_fill(UartReader_t *r);		//waits for more input, returns the first byte or -1 on a read error
+
+//next received byte, waiting if the buffer is empty. -1 on a read error
+static inline int uart_getc(UartReader_t *r)
+{
+	if (r->next < r->count) return r->buffer[r->next++];
+	return uart_fill(r);
+}
 
 #endif
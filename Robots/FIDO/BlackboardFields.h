@@ -0,0 +1,14 @@
+//
+//  BlackboardFields.h
+//
+//  Payload fields of saved messages that blackboard queries can aggregate by name
+//  Numeric fields only - the type is taken from the message definition
+//
+
+//fieldmacro(name, messageType, member)
+
+fieldmacro("battery.volts", BATTERY, batteryPayload.volts)
+fieldmacro("battery.status", BATTERY, batteryPayload.status)
+fieldmacro("notification.value", NOTIFICATION, intPayload.value)
+fieldmacro("tick.powerstate", TICK_1S, tickPayload.systemPowerState)
+fieldmacro("tick.notifications", TICK_1S, tickPayload.activeNotifications)
@@ -17,6 +17,7 @@
 
 //enabled subsystem debug
 //#define BROKER_DEBUG
+//#define BROKER_TRACE		//per-message trace, also needs psTraceMessages set at run time
 
 //#define UART_BROKER_DEBUG
 
@@ -52,17 +53,49 @@
 #define SPARE_ANALOG0		AN0
 #define SPARE_ANALOG1		AN1
 
+//broker dispatch
+#define PS_DISPATCHERS		1		//routing threads - the AM335x has one core
+//#define PS_DISPATCH_PIN			//pin dispatcher n to CPU n
+//#define PS_SHM_TRANSPORT		//export all messages on the shm ring for local tools
+									//costs a queue append per message, readers or not
+
 //UART broker
 #define PS_UART_DEVICE 		"/dev/ttyO5"
 #define PS_TX_PIN				"P8_37"
 #define PS_RX_PIN				"P8_38"
 #define PS_UART_BAUDRATE 	B115200
+#define PS_UART_VMIN		1		//return whatever the driver holds - a wait for more would
+#define PS_UART_VTIME		0		//delay a short or split frame by up to VTIME
+#define PS_UART_TX_DEPTH	64		//TX queue per lane - stale telemetry is dropped oldest first, urgent refused
+#define PS_UART_TX_RATE		10000	//bytes/sec paced onto the link - 115200 baud less margin
+#define PS_UART_TX_BURST	256		//bytes the link may run ahead - bounds the driver FIFO
+
+//UART per-topic budgets - bytes/sec and burst bytes. urgent (first QOS) messages are never held to these
+#define PS_UART_LOG_RATE	200
+#define PS_UART_LOG_BURST	1000
+#define PS_UART_STATS_RATE	500
+#define PS_UART_STATS_BURST	1000
+#define PS_UART_REPORT_RATE	2000
+#define PS_UART_REPORT_BURST	1000
+
+//UART reliable channel - urgent messages ACKed and retransmitted. the PIC must be built to match
+//#define PS_UART_RELIABLE
+#define PS_UART_WINDOW		16		//reliable frames in flight, at most 32
+#define PS_UART_RTO_INIT	200		//mS retransmit timeout before the first round trip is measured
+#define PS_UART_RTO_MIN		20
+#define PS_UART_RTO_MAX		1000
+#define PS_UART_RETRIES		8		//transmissions before a frame is given up
+
+//UART compact telemetry - ODOMETRY and IMU_REPORT from the PIC delta coded. the PIC must be built to match
+//#define PS_UART_COMPACT
 
 //GPS
 #define GPS_UART_DEVICE 	"/dev/ttyO2"
 #define GPS_TX_PIN				"P9_21"
 #define GPS_RX_PIN				"P9_22"
 #define GPS_UART_BAUDRATE 	B9600
+#define GPS_UART_VMIN		64
+#define GPS_UART_VTIME		1
 
 //CAMERA
 #define CAMERA_UART_DEVICE 	"/dev/ttyO1"
@@ -124,13 +157,11 @@
 //logfiles folder
 #define LOGFILE_FOLDER "/root/logfiles"
 
+//blackboard history - kept across restarts
+#define BB_HISTORY_FILE "/root/blackboard.history"
+
 //Logging levels
 #define LOG_TO_SERIAL               LOG_ALL     //printed in real-time
 #define SYSLOG_LEVEL                LOG_ALL  	//published log
 
-#define MAX_ROUTINE 1
-#define MAX_INFO 1
-#define MAX_WARNING 1
-#define MAX_ERROR 10
-
 #endif
@@ -16,6 +16,7 @@
 #include "SoftwareProfile.h"
 #include "PubSubData.h"
 #include "pubsub/pubsub.h"
+#include "pubsub/shmBroker.h"
 #include "blackboard/blackboard.h"
 #include "behavior/behavior.h"
 #include "syslog/syslog.h"
@@ -85,7 +86,7 @@ int main(int argc, const char * argv[])
 	DEBUGPRINT("main() start init\n");
 
 	//initialize the broker queues
-	BrokerQueueInit(100);
+	BrokerQueueInit(BROKER_POOL_PRELOAD);
 
 	//syslog
 	if ((reply=SysLogInit(argc, argv)) != 0)
@@ -129,6 +130,18 @@ int main(int argc, const char * argv[])
 	}
 	DEBUGPRINT("ResponderInit() OK\n");
 
+#ifdef PS_SHM_TRANSPORT
+	//shared-memory ring for local tools - not essential
+	if ((reply=ShmBrokerInit()) < 0)
+	{
+		ERRORPRINT("*** ShmBrokerInit() fail\n");
+	}
+	else
+	{
+		DEBUGPRINT("ShmBrokerInit() OK\n");
+	}
+#endif
+
 	//syslog & broker & serialbroker running
 	//can now use LogError()
 